@@ -0,0 +1,498 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <libgen.h>
+#include <sys/resource.h>
+
+#include "toml.h"
+
+/*
+ * Parse, lookup, JSON export and free timings for generated documents of a
+ * number of shapes.  The documents are built from a fixed seed, so runs on
+ * different versions of the library measure the same input.
+ */
+
+#define GET_ROUNDS	100
+
+struct corpus {
+	char*	buf;
+	size_t	len;
+	size_t	size;
+	char**	paths;		/* for toml_get */
+	size_t	npaths;
+	size_t	paths_size;
+	uint64_t	seed;
+};
+
+struct shape {
+	const char*	name;
+	void		(*generate)(struct corpus*, size_t);
+};
+
+/*
+ * Allocations are counted by standing in for malloc and friends, the library
+ * picks these up as the executable's symbols come first.
+ */
+#ifdef __GLIBC__
+extern void* __libc_malloc(size_t);
+extern void* __libc_calloc(size_t, size_t);
+extern void* __libc_realloc(void*, size_t);
+extern void __libc_free(void*);
+
+static unsigned long	allocations;
+
+void*
+malloc(size_t size)
+{
+	__atomic_fetch_add(&allocations, 1, __ATOMIC_RELAXED);
+	return __libc_malloc(size);
+}
+
+void*
+calloc(size_t n, size_t size)
+{
+	__atomic_fetch_add(&allocations, 1, __ATOMIC_RELAXED);
+	return __libc_calloc(n, size);
+}
+
+void*
+realloc(void* p, size_t size)
+{
+	__atomic_fetch_add(&allocations, 1, __ATOMIC_RELAXED);
+	return __libc_realloc(p, size);
+}
+
+void
+free(void* p)
+{
+	__libc_free(p);
+}
+
+#define ALLOCATIONS()	__atomic_load_n(&allocations, __ATOMIC_RELAXED)
+#else
+#define ALLOCATIONS()	0UL
+#endif
+
+static void
+usage(char *progname, int exit_code, char *msg)
+{
+	char *bname = basename(progname);
+
+	if (msg) {
+		fprintf(stderr, "%s\n", msg);
+	}
+	fprintf(stderr, "Usage: %s [-s <MB>] [-n <runs>] [-k <shape>] [-j <threads>] [-a] [-b] [-t] [-o <dir>]\n", bname);
+	fprintf(stderr, "\t-s <MB>			size of each document (default 8)\n");
+	fprintf(stderr, "\t-n <runs>		runs of each phase, the best is reported (default 5)\n");
+	fprintf(stderr, "\t-k <shape>		only this shape\n");
+	fprintf(stderr, "\t-j <threads>		parse with this many threads\n");
+	fprintf(stderr, "\t-a				parse into an arena\n");
+	fprintf(stderr, "\t-b				borrow names and strings from the input\n");
+	fprintf(stderr, "\t-t				trust the input to be UTF-8\n");
+	fprintf(stderr, "\t-o <dir>			also write the documents to <dir>\n");
+
+	exit(exit_code);
+}
+
+static void
+die(const char* what)
+{
+	fprintf(stderr, "%s: %s\n", what, strerror(errno));
+	exit(EXIT_FAILURE);
+}
+
+static void
+emit(struct corpus* c, const char* fmt, ...)
+{
+	va_list	ap;
+	int		len;
+
+	for (;;) {
+		va_start(ap, fmt);
+		len = vsnprintf(c->buf + c->len, c->size - c->len, fmt, ap);
+		va_end(ap);
+
+		if ((size_t)len < c->size - c->len)
+			break;
+
+		c->size = c->size ? c->size * 2 : 1024 * 1024;
+		c->buf = realloc(c->buf, c->size);
+		if (!c->buf)
+			die("realloc");
+	}
+
+	c->len += len;
+}
+
+static void
+remember(struct corpus* c, const char* fmt, ...)
+{
+	va_list	ap;
+	char*	path;
+	int		len;
+
+	if (c->npaths == c->paths_size) {
+		c->paths_size = c->paths_size ? c->paths_size * 2 : 256;
+		c->paths = realloc(c->paths, c->paths_size * sizeof(*c->paths));
+		if (!c->paths)
+			die("realloc");
+	}
+
+	va_start(ap, fmt);
+	len = vsnprintf(NULL, 0, fmt, ap);
+	va_end(ap);
+
+	path = malloc(len + 1);
+	if (!path)
+		die("malloc");
+
+	va_start(ap, fmt);
+	vsnprintf(path, len + 1, fmt, ap);
+	va_end(ap);
+
+	c->paths[c->npaths++] = path;
+}
+
+/*
+ * xorshift64*, good enough to vary the data and the same everywhere.  Never
+ * call it twice in one argument list, the order would be up to the compiler.
+ */
+static uint32_t
+next(struct corpus* c)
+{
+	c->seed ^= c->seed >> 12;
+	c->seed ^= c->seed << 25;
+	c->seed ^= c->seed >> 27;
+
+	return (c->seed * 0x2545F4914F6CDD1DULL) >> 32;
+}
+
+static void
+gen_wide(struct corpus* c, size_t size)
+{
+	size_t i;
+
+	emit(c, "[wide]\n");
+	for (i = 0; c->len < size; i++) {
+		emit(c, "key%zu = %u\n", i, next(c));
+		if (i % 64 == 0)
+			remember(c, "wide.key%zu", i);
+	}
+}
+
+static void
+gen_deep(struct corpus* c, size_t size)
+{
+	size_t		i;
+	uint32_t	x, y;
+
+	for (i = 0; c->len < size; i++) {
+		x = next(c);
+		y = next(c);
+		emit(c, "[deep.n%zu.a.b.c.d.e.f.g.h.i.j.k.l.m.n.o]\n"
+				"x = %u\ny = \"%08x\"\nz = true\n\n", i, x, y);
+		if (i % 16 == 0)
+			remember(c, "deep.n%zu.a.b.c.d.e.f.g.h.i.j.k.l.m.n.o.y", i);
+	}
+}
+
+static void
+gen_table_array(struct corpus* c, size_t size)
+{
+	size_t i;
+
+	for (i = 0; c->len < size; i++) {
+		emit(c, "[[product]]\nid = %zu\nname = \"product %zu\"\n", i, i);
+		emit(c, "price = %u", next(c) % 1000);
+		emit(c, ".%02u\n", next(c) % 100);
+		emit(c, "tags = [ \"t%u\"", next(c) % 50);
+		emit(c, ", \"t%u\" ]\n\n", next(c) % 50);
+	}
+	remember(c, "product");
+}
+
+static void
+gen_numbers(struct corpus* c, size_t size)
+{
+	size_t		i, j;
+	uint32_t	shift;
+
+	for (i = 0; c->len < size; i++) {
+		emit(c, "ints%zu = [ ", i);
+		for (j = 0; j < 256; j++) {
+			shift = next(c) % 31;
+			emit(c, "%s%d", j ? ", " : "", (int)next(c) >> shift);
+		}
+		emit(c, " ]\nfloats%zu = [ ", i);
+		for (j = 0; j < 256; j++) {
+			emit(c, "%s%u", j ? ", " : "", next(c) % 100000);
+			emit(c, ".%u", next(c) % 1000);
+		}
+		emit(c, " ]\n");
+		remember(c, "floats%zu", i);
+	}
+}
+
+static void
+gen_escapes(struct corpus* c, size_t size)
+{
+	static const char* pieces[] = {
+		"plain text ", "\\t", "\\n", "\\\"quoted\\\"", "\\\\", "\\u00e9",
+		"\\U0001F600", "/path/", "\\r\\n",
+	};
+	size_t i, j;
+
+	for (i = 0; c->len < size; i++) {
+		emit(c, "s%zu = \"", i);
+		for (j = 0; j < 24; j++)
+			emit(c, "%s", pieces[next(c) % (sizeof(pieces) / sizeof(pieces[0]))]);
+		emit(c, "\"\n");
+		if (i % 32 == 0)
+			remember(c, "s%zu", i);
+	}
+}
+
+static void
+gen_multi_line(struct corpus* c, size_t size)
+{
+	size_t i, j, k;
+
+	for (i = 0; c->len < size; i++) {
+		emit(c, i % 2 ? "m%zu = '''\n" : "m%zu = \"\"\"\n", i);
+		for (j = 0; j < 64; j++) {
+			for (k = 0; k < 64; k++)
+				emit(c, "%c", "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/"[next(c) % 64]);
+			emit(c, "\n");
+		}
+		emit(c, i % 2 ? "'''\n" : "\"\"\"\n");
+		remember(c, "m%zu", i);
+	}
+}
+
+static void
+gen_dates(struct corpus* c, size_t size)
+{
+	size_t i;
+
+	for (i = 0; c->len < size; i++) {
+		emit(c, "d%zu = %04u", i, 1970 + next(c) % 100);
+		emit(c, "-%02u", 1 + next(c) % 12);
+		emit(c, "-%02u", 1 + next(c) % 28);
+		emit(c, "T%02u", next(c) % 24);
+		emit(c, ":%02u", next(c) % 60);
+		emit(c, ":%02u", next(c) % 60);
+		switch (i % 3) {
+		case 0:
+			emit(c, "Z\n");
+			break;
+		case 1:
+			emit(c, ".%06u-07:00\n", next(c) % 1000000);
+			break;
+		case 2:
+			emit(c, "+05:30\n");
+			break;
+		}
+		if (i % 64 == 0)
+			remember(c, "d%zu", i);
+	}
+}
+
+static const struct shape shapes[] = {
+	{ "wide",			gen_wide },
+	{ "deep",			gen_deep },
+	{ "table_array",	gen_table_array },
+	{ "numbers",		gen_numbers },
+	{ "escapes",		gen_escapes },
+	{ "multi_line",		gen_multi_line },
+	{ "dates",			gen_dates },
+};
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long
+peak_rss(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_maxrss;
+}
+
+static void
+count_node(struct toml_node* node __attribute__((unused)), void* ctx)
+{
+	(*(size_t*)ctx)++;
+}
+
+struct phase {
+	double			best;
+	unsigned long	allocations;
+};
+
+static void
+phase_start(double* t0, unsigned long* a0)
+{
+	*a0 = ALLOCATIONS();
+	*t0 = now();
+}
+
+static void
+phase_end(struct phase* phase, double t0, unsigned long a0)
+{
+	double elapsed = now() - t0;
+
+	if (!phase->best || elapsed < phase->best)
+		phase->best = elapsed;
+	phase->allocations = ALLOCATIONS() - a0;
+}
+
+static void
+report(const char* shape, const char* name, struct phase* phase, size_t bytes,
+															size_t items)
+{
+	printf("%-12s %-8s %10.1f %14.0f %12lu %10ld\n", shape, name,
+			bytes ? bytes / phase->best / (1024 * 1024) : 0.0,
+			items / phase->best, phase->allocations, peak_rss());
+}
+
+int main(int argc, char **argv)
+{
+	int						ch, runs = 5, arena = 0, i;
+	size_t					size = 8, nodes = 0, json_len = 0, j, k;
+	char					*only = NULL, *dir = NULL, path[4096];
+	struct toml_parse_opts	opts = { 0 };
+	struct toml_node		*root;
+	struct toml_writer		*w;
+	struct corpus			c;
+	struct phase			parse, get, tojson, release;
+	double					t0;
+	unsigned long			a0;
+	FILE					*f;
+
+	while((ch = getopt(argc, argv, "s:n:k:j:abto:h")) != -1) {
+		switch (ch) {
+		case 's':
+			size = strtoul(optarg, NULL, 0);
+			break;
+
+		case 'n':
+			runs = atoi(optarg);
+			break;
+
+		case 'k':
+			only = optarg;
+			break;
+
+		case 'j':
+			opts.threads = atoi(optarg);
+			break;
+
+		case 'a':
+			arena = 1;
+			break;
+
+		case 'b':
+			opts.flags |= TOML_PARSE_BORROW;
+			break;
+
+		case 't':
+			opts.flags |= TOML_PARSE_TRUSTED;
+			break;
+
+		case 'o':
+			dir = optarg;
+			break;
+
+		default:
+			usage(argv[0], 1, NULL);
+			break;
+		}
+	}
+
+	if (!size || runs < 1)
+		usage(argv[0], 1, "size and runs must be positive");
+
+	printf("%-12s %-8s %10s %14s %12s %10s\n", "shape", "phase", "MB/s",
+									"items/s", "allocations", "peak KB");
+
+	for (i = 0; i < (int)(sizeof(shapes) / sizeof(shapes[0])); i++) {
+		if (only && strcmp(only, shapes[i].name))
+			continue;
+
+		memset(&c, 0, sizeof(c));
+		c.seed = 0x9E3779B97F4A7C15ULL + i;
+		shapes[i].generate(&c, size * 1024 * 1024);
+
+		if (dir) {
+			snprintf(path, sizeof(path), "%s/%s.toml", dir, shapes[i].name);
+			f = fopen(path, "w");
+			if (!f || fwrite(c.buf, 1, c.len, f) != c.len || fclose(f))
+				die(path);
+		}
+
+		memset(&parse, 0, sizeof(parse));
+		memset(&get, 0, sizeof(get));
+		memset(&tojson, 0, sizeof(tojson));
+		memset(&release, 0, sizeof(release));
+
+		for (j = 0; j < (size_t)runs; j++) {
+			phase_start(&t0, &a0);
+			if ((arena ? toml_init_arena(&root) : toml_init(&root)) ||
+						toml_parse_with_opts(root, c.buf, c.len, &opts)) {
+				fprintf(stderr, "%s: parse failed\n", shapes[i].name);
+				exit(EXIT_FAILURE);
+			}
+			phase_end(&parse, t0, a0);
+
+			phase_start(&t0, &a0);
+			for (k = 0; k < c.npaths * GET_ROUNDS; k++) {
+				if (!toml_get(root, c.paths[k % c.npaths])) {
+					fprintf(stderr, "%s: no %s\n", shapes[i].name, c.paths[k % c.npaths]);
+					exit(EXIT_FAILURE);
+				}
+			}
+			phase_end(&get, t0, a0);
+
+			w = toml_writer_buffer();
+			if (!w)
+				die("toml_writer_buffer");
+			phase_start(&t0, &a0);
+			if (toml_tojson_to(root, w))
+				die("toml_tojson_to");
+			phase_end(&tojson, t0, a0);
+			toml_writer_data(w, &json_len);
+			toml_writer_free(w);
+
+			nodes = 0;
+			toml_walk(root, count_node, &nodes);
+
+			phase_start(&t0, &a0);
+			toml_free(root);
+			phase_end(&release, t0, a0);
+		}
+
+		report(shapes[i].name, "parse", &parse, c.len, nodes);
+		report(shapes[i].name, "get", &get, 0, c.npaths * GET_ROUNDS);
+		report(shapes[i].name, "tojson", &tojson, json_len, nodes);
+		report(shapes[i].name, "free", &release, 0, nodes);
+
+		for (j = 0; j < c.npaths; j++)
+			free(c.paths[j]);
+		free(c.paths);
+		free(c.buf);
+	}
+
+	return EXIT_SUCCESS;
+}
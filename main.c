@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
@@ -7,6 +8,9 @@
 #include <sys/stat.h>
 #include <sys/mman.h>
 #include <libgen.h>
+#include <ftw.h>
+#include <pthread.h>
+#include <time.h>
 
 #include "toml.h"
 
@@ -19,17 +23,258 @@ usage(char *progname, int exit_code, char *msg)
 		fprintf(stderr, "%s\n", msg);
 	}
 	fprintf(stderr, "Usage: %s [-t <toml_file>] [-d] [-j] [-g <key>]\n", bname);
+	fprintf(stderr, "       %s [-j] [-n <threads>] [-v] <file|dir>...\n", bname);
 	fprintf(stderr, "\t-t <toml_file>	file to parse\n");
 	fprintf(stderr, "\t-d				dump file contents\n");
-	fprintf(stderr, "\t-j				dump as JSON (default is TOML)\n");
+	fprintf(stderr, "\t-j				dump as JSON (default is TOML), with many\n");
+	fprintf(stderr, "\t				files write <file>.json next to each\n");
 	fprintf(stderr, "\t-g <key>			dump file contents starting from <key>\n");
+	fprintf(stderr, "\t-n <threads>		parse many files on this many threads\n");
+	fprintf(stderr, "\t				(default one per core)\n");
+	fprintf(stderr, "\t-v				time each of many files\n");
 
 	exit(exit_code);
 }
 
+/*
+ * Many files, or the .toml files under directories, are checked in one
+ * process by a pool of threads each taking the next file off the list.
+ */
+struct batch {
+	char**			files;
+	size_t			count;
+	size_t			size;
+	size_t			next;
+	int				json;
+	int				verbose;
+	size_t			failed;
+	size_t			bytes;
+};
+
+static struct batch batch;
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+batch_add(const char *path)
+{
+	char **files;
+
+	if (batch.count == batch.size) {
+		size_t size = batch.size ? batch.size * 2 : 256;
+
+		files = realloc(batch.files, size * sizeof(*files));
+		if (!files)
+			return -1;
+		batch.files = files;
+		batch.size = size;
+	}
+
+	batch.files[batch.count] = strdup(path);
+	if (!batch.files[batch.count])
+		return -1;
+	batch.count++;
+
+	return 0;
+}
+
+static int
+batch_walker(const char *path, const struct stat *st __attribute__((unused)), int type,
+								struct FTW *ftw __attribute__((unused)))
+{
+	size_t len = strlen(path);
+
+	if (type != FTW_F || len < 5 || strcmp(path + len - 5, ".toml") != 0)
+		return 0;
+
+	return batch_add(path);
+}
+
+static int
+batch_json(struct toml_node *root, const char *file)
+{
+	struct toml_writer	*out;
+	char				*path;
+	int					fd, ret;
+
+	if (asprintf(&path, "%s.json", file) == -1)
+		return ENOMEM;
+
+	fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+	free(path);
+	if (fd == -1)
+		return errno;
+
+	out = toml_writer_fd(fd);
+	if (!out) {
+		close(fd);
+		return ENOMEM;
+	}
+
+	toml_tojson_to(root, out);
+	ret = toml_writer_free(out);
+
+	if (close(fd) && !ret)
+		ret = errno;
+
+	return ret;
+}
+
+/* 0 if file parsed, and its JSON was written if wanted */
+static int
+batch_file(const char *file, size_t *bytes)
+{
+	struct toml_parse_opts	opts = { .flags = TOML_PARSE_BORROW };
+	struct toml_node		*root;
+	struct stat				st;
+	void					*content = NULL;
+	int						fd, ret = 1;
+
+	fd = open(file, O_RDONLY);
+	if (fd == -1) {
+		fprintf(stderr, "%s: open: %s\n", file, strerror(errno));
+		return 1;
+	}
+
+	if (fstat(fd, &st) == -1) {
+		fprintf(stderr, "%s: stat: %s\n", file, strerror(errno));
+		goto out;
+	}
+
+	if (st.st_size) {
+		content = mmap(NULL, st.st_size, PROT_READ, MAP_FILE|MAP_PRIVATE, fd, 0);
+		if (content == MAP_FAILED) {
+			fprintf(stderr, "%s: mmap: %s\n", file, strerror(errno));
+			content = NULL;
+			goto out;
+		}
+	}
+	*bytes = st.st_size;
+
+	/* nothing of the document outlives this file */
+	if (toml_init_arena(&root) == -1) {
+		fprintf(stderr, "%s: toml_init: %s\n", file, strerror(errno));
+		goto out;
+	}
+
+	ret = toml_parse_with_opts(root, content, st.st_size, &opts);
+	if (ret) {
+		fprintf(stderr, "%s: parse failed\n", file);
+	} else if (batch.json) {
+		ret = batch_json(root, file);
+		if (ret)
+			fprintf(stderr, "%s.json: %s\n", file, strerror(ret));
+	}
+
+	toml_free(root);
+
+out:
+	if (content)
+		munmap(content, st.st_size);
+	close(fd);
+
+	return ret;
+}
+
+static void *
+batch_worker(void *arg __attribute__((unused)))
+{
+	size_t	i, bytes;
+	double	start;
+	int		ret;
+
+	for (;;) {
+		i = __atomic_fetch_add(&batch.next, 1, __ATOMIC_RELAXED);
+		if (i >= batch.count)
+			break;
+
+		bytes = 0;
+		start = now();
+		ret = batch_file(batch.files[i], &bytes);
+
+		if (batch.verbose)
+			printf("%s\t%s\t%zu bytes\t%.3f ms\n", batch.files[i],
+						ret ? "FAIL" : "ok", bytes, (now() - start) * 1e3);
+
+		__atomic_fetch_add(&batch.bytes, bytes, __ATOMIC_RELAXED);
+		if (ret)
+			__atomic_fetch_add(&batch.failed, 1, __ATOMIC_RELAXED);
+	}
+
+	return NULL;
+}
+
+static int
+batch_run(char **paths, int count, long threads)
+{
+	pthread_t	*pool;
+	struct stat	st;
+	double		start, elapsed;
+	long		started = 0, i;
+
+	for (i = 0; i < count; i++) {
+		if (stat(paths[i], &st) == 0 && S_ISDIR(st.st_mode)) {
+			if (nftw(paths[i], batch_walker, 32, FTW_PHYS)) {
+				fprintf(stderr, "%s: %s\n", paths[i], strerror(errno));
+				return EXIT_FAILURE;
+			}
+		} else if (batch_add(paths[i])) {
+			fprintf(stderr, "%s\n", strerror(errno));
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (threads < 1)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads < 1)
+		threads = 1;
+	if ((size_t)threads > batch.count)
+		threads = batch.count ? batch.count : 1;
+
+	pool = calloc(threads, sizeof(*pool));
+	if (!pool) {
+		fprintf(stderr, "calloc: %s\n", strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	start = now();
+
+	/* this thread is a worker too */
+	for (i = 0; i + 1 < threads; i++) {
+		if (pthread_create(&pool[started], NULL, batch_worker, NULL))
+			break;
+		started++;
+	}
+	batch_worker(NULL);
+
+	for (i = 0; i < started; i++)
+		pthread_join(pool[i], NULL);
+
+	elapsed = now() - start;
+	fprintf(stderr, "%zu files, %zu failed, %.1f MB in %.3f s on %ld threads, "
+			"%.1f MB/s, %.0f files/s\n", batch.count, batch.failed,
+			batch.bytes / 1e6, elapsed, started + 1,
+			elapsed > 0 ? batch.bytes / 1e6 / elapsed : 0,
+			elapsed > 0 ? batch.count / elapsed : 0);
+
+	for (i = 0; (size_t)i < batch.count; i++)
+		free(batch.files[i]);
+	free(batch.files);
+	free(pool);
+
+	return batch.failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
 int main(int argc, char **argv)
 {
-	int					fd, ret, toml_content_size = 0;
+	int					fd = -1, ret, toml_content_size = 0;
 	struct toml_node	*toml_root;
 	void				*toml_content = NULL;
 	struct stat			st;
@@ -37,6 +282,9 @@ int main(int argc, char **argv)
 	char				*file = NULL, *get = NULL;
 	int					exit_code = EXIT_SUCCESS;
 	char*				bname;
+	long				threads = 0;
+	int					verbose = 0;
+	struct toml_parse_opts	opts = { .flags = TOML_PARSE_BORROW };
 
 	bname = basename(argv[0]);
 	if (strcmp(bname, "parser_test") == 0) {
@@ -44,7 +292,7 @@ int main(int argc, char **argv)
 		json = 1;
 	}
 
-	while((ch = getopt(argc, argv, "t:dg:hj")) != -1) {
+	while((ch = getopt(argc, argv, "t:dg:hjn:v")) != -1) {
 		switch (ch) {
 		case 't':
 			file = optarg;
@@ -66,12 +314,35 @@ int main(int argc, char **argv)
 			json = 1;
 			break;
 
+		case 'n':
+			threads = atol(optarg);
+			break;
+
+		case 'v':
+			verbose = 1;
+			break;
+
 		default:
 			usage(argv[0], 1, NULL);
 			break;
 		}
 	}
 
+	if (optind < argc) {
+		if (file || dump || get)
+			usage(argv[0], 1, "-t, -d and -g take a single file");
+
+		batch.json = json;
+		batch.verbose = verbose;
+		exit(batch_run(argv + optind, argc - optind, threads));
+	}
+
+	ret = toml_init(&toml_root);
+	if (ret == -1) {
+		fprintf(stderr, "toml_init: %s\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
 	if (file) {
 		fd = open(file, O_RDONLY);
 		if (fd == -1) {
@@ -86,76 +357,82 @@ int main(int argc, char **argv)
 		}
 
 		toml_content = mmap(NULL, st.st_size, PROT_READ, MAP_FILE|MAP_PRIVATE, fd, 0);
-		if (!toml_content) {
+		if (toml_content == MAP_FAILED) {
 			fprintf(stderr, "mmap: %s\n", strerror(errno));
 			exit(EXIT_FAILURE);
 		}
 
 		toml_content_size = st.st_size;
+
+		/* the mapping outlives the document, so nodes can point straight into it */
+		ret = toml_parse_with_opts(toml_root, toml_content, toml_content_size, &opts);
 	} else {
-		const int size = 1024*1024;
-		int i, bytes_read;
-
-		for (i = 0; 1; i++) {
-			toml_content = realloc(toml_content, size * (i+1));
-			if (!toml_content) {
-				fprintf(stderr, "realloc: %s\n", strerror(errno));
-				exit(EXIT_FAILURE);
-			}
+		char	chunk[64 * 1024];
+		ssize_t	bytes_read;
 
-			bytes_read = read(STDIN_FILENO, &toml_content[size*i], size);
-			toml_content_size += bytes_read;
+		/* parse stdin as it arrives rather than collecting all of it first */
+		ret = 0;
+		while (!ret && (bytes_read = read(STDIN_FILENO, chunk, sizeof(chunk))) > 0)
+			ret = toml_parse_chunk(toml_root, chunk, bytes_read);
 
-			if (bytes_read < size)
-				break;
+		if (bytes_read == -1) {
+			fprintf(stderr, "read: %s\n", strerror(errno));
+			ret = 1;
 		}
-	}
 
-	ret = toml_init(&toml_root);
-	if (ret == -1) {
-		fprintf(stderr, "toml_init: %s\n", strerror(errno));
-		exit(EXIT_FAILURE);
+		if (toml_parse_finish(toml_root))
+			ret = 1;
 	}
 
-	ret = toml_parse(toml_root, toml_content, toml_content_size);
 	if (ret) {
 		exit_code = EXIT_FAILURE;
 		goto bail;
 	}
 
-	if (file) {
-		ret = munmap(toml_content, toml_content_size);
-		if (ret) {
-			fprintf(stderr, "munmap: %s\n", strerror(errno));
+	if (dump || get) {
+		struct toml_node *node = toml_root;
+		struct toml_writer *out;
+
+		if (get && !dump) {
+			node = toml_get(toml_root, get);
+			if (!node) {
+				fprintf(stderr, "no node '%s'\n", get);
+				exit_code = EXIT_FAILURE;
+				goto bail;
+			}
+		}
+
+		out = toml_writer_fd(STDOUT_FILENO);
+		if (!out) {
+			fprintf(stderr, "toml_writer_fd: %s\n", strerror(errno));
 			exit_code = EXIT_FAILURE;
 			goto bail;
 		}
 
-		close(fd);
-	}
-
-	if (dump) {
 		if (json)
-			toml_tojson(toml_root, stdout);
+			toml_tojson_to(node, out);
 		else
-			toml_dump(toml_root, stdout);
-	} else if (get) {
-		struct toml_node *node = toml_get(toml_root, get);
+			toml_dump_to(node, out);
 
-		if (!node) {
-			fprintf(stderr, "no node '%s'\n", get);
+		ret = toml_writer_free(out);
+		if (ret) {
+			fprintf(stderr, "write: %s\n", strerror(ret));
 			exit_code = EXIT_FAILURE;
-			goto bail;
 		}
-
-		if (json)
-			toml_tojson(node, stdout);
-		else
-			toml_dump(node, stdout);
 	}
 
 bail:
 	toml_free(toml_root);
 
+	if (file) {
+		ret = munmap(toml_content, toml_content_size);
+		if (ret) {
+			fprintf(stderr, "munmap: %s\n", strerror(errno));
+			exit_code = EXIT_FAILURE;
+		}
+
+		close(fd);
+	}
+
 	exit(exit_code);
 }
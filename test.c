@@ -1,8 +1,10 @@
+#include <stddef.h>
 #include <stdlib.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <unistd.h>
+#include <errno.h>
 
 #include "CUnit/Basic.h"
 #include "toml.h"
@@ -125,6 +127,94 @@ testUTF16(void)
 	toml_free(root);
 }
 
+static void
+testSurrogates(void)
+{
+	int					i;
+	struct toml_node*	node;
+	struct toml_node*	root;
+	char				pair[] = "s = \"\\u7F16\\uD83D\\uDE00\\u0041\"";
+	char				expected_result[] = {
+		0xe7, 0xbc, 0x96, 0xf0, 0x9f, 0x98, 0x80, 0x41 };
+	char*				bad[] = {
+		"s = \"\\uD83D\"",
+		"s = \"\\uDE00\\uD83D\"",
+		"s = \"\\uD83Dx\\uDE00\"",
+		"s = \"\\uD83D\\n\"",
+		"s = \"\\uD83D\\uD83D\"",
+		"s = \"\\U0000D83D\"",
+		"s = \"\\U00110000\"",
+	};
+
+	toml_init(&root);
+	CU_ASSERT(toml_parse(root, pair, strlen(pair)) == 0);
+
+	node = toml_get(root, "s");
+	CU_ASSERT_FATAL(node != NULL);
+	CU_ASSERT(node->type == TOML_STRING);
+	CU_ASSERT(node->value.string_len == sizeof(expected_result));
+	CU_ASSERT(memcmp(node->value.string, expected_result, sizeof(expected_result)) == 0);
+
+	toml_free(root);
+
+	for (i = 0; i < ARRAY_LENGTH(bad); i++) {
+		toml_init(&root);
+		CU_ASSERT(toml_parse(root, bad[i], strlen(bad[i])) != 0);
+		toml_free(root);
+	}
+}
+
+static void
+testUTF8Validation(void)
+{
+	int						i;
+	size_t					len;
+	struct toml_node*		root;
+	struct toml_node*		node;
+	struct toml_parse_opts	opts = { TOML_PARSE_TRUSTED };
+	char					good[] = "s = \"\xe7\xbc\x96\xf0\x9f\x98\x80\" # \xc3\xa9\n";
+	char*					bad[] = {
+		"s = \"\xff\"\n",
+		"s = \"\xc0\xaf\"\n",
+		"s = \"\xed\xa0\x80\"\n",
+		"s = \"\xf4\x90\x80\x80\"\n",
+		"s = \"x\" # \xe7\xbc\n",
+		"s = \"x\" # \xe7\xbc",
+	};
+
+	/* split between chunks at every byte */
+	toml_init(&root);
+	for (i = 0; good[i]; i++)
+		CU_ASSERT(toml_parse_chunk(root, good + i, 1) == 0);
+	CU_ASSERT(toml_parse_finish(root) == 0);
+	node = toml_get(root, "s");
+	CU_ASSERT_FATAL(node != NULL);
+	CU_ASSERT(node->value.string_len == 7);
+	toml_free(root);
+
+	for (i = 0; i < ARRAY_LENGTH(bad); i++) {
+		len = strlen(bad[i]);
+
+		toml_init(&root);
+		CU_ASSERT(toml_parse(root, bad[i], len) != 0);
+		toml_free(root);
+
+		toml_init(&root);
+		CU_ASSERT(toml_parse_chunk(root, bad[i], len - 2) != 0 ||
+					toml_parse_chunk(root, bad[i] + len - 2, 2) != 0 ||
+					toml_parse_finish(root) != 0);
+		toml_free(root);
+	}
+
+	/* trusted input is taken as it is */
+	toml_init(&root);
+	CU_ASSERT(toml_parse_with_opts(root, bad[0], strlen(bad[0]), &opts) == 0);
+	node = toml_get(root, "s");
+	CU_ASSERT_FATAL(node != NULL);
+	CU_ASSERT(node->value.string_len == 1);
+	toml_free(root);
+}
+
 static void
 testUTF32(void)
 {
@@ -318,6 +408,18 @@ testRFC3339(void)
 		{
 			"rfc3339 = 1977-10-30T08:00:00.123+00:00",
 			"1977-10-30T08:00:00.123+00:00"
+		},
+		{
+			"rfc3339 = 1979-05-27T00:32:00.000999-07:00",
+			"1979-05-27T00:32:00.000999-07:00"
+		},
+		{
+			"rfc3339 = 2000-02-29T23:59:59.5+05:30",
+			"2000-02-29T23:59:59.5+05:30"
+		},
+		{
+			"rfc3339 = 1969-12-31T23:59:59Z",
+			"1969-12-31T23:59:59Z"
 		}
 	};
 
@@ -345,6 +447,60 @@ testRFC3339(void)
 	}
 }
 
+static void
+testDates(void)
+{
+	struct toml_node*	root;
+	struct toml_node*	node;
+	char				buf[TOML_DATE_MAX];
+	char*				bad[] = {
+		"a = 2001-02-29T00:00:00Z",
+		"a = 2001-13-01T00:00:00Z",
+		"a = 2001-01-01T24:00:00Z",
+		"a = 2001-01-01T00:60:00Z",
+	};
+	char				doc[] =
+		"utc = 1979-05-27T07:32:00Z\n"
+		"local = 1979-05-27T00:32:00.999999999123-07:00\n"
+		"early = 1600-01-01T00:00:00+01:00\n";
+	int					i;
+
+	toml_init(&root);
+	CU_ASSERT_FATAL(toml_parse(root, doc, strlen(doc)) == 0);
+
+	/* the same instant whatever the offset */
+	node = toml_get(root, "utc");
+	CU_ASSERT_FATAL(node != NULL);
+	CU_ASSERT(node->value.rfc3339_time.epoch == 296638320);
+	CU_ASSERT(toml_format_date(node, buf, sizeof(buf)) == 20);
+	CU_ASSERT(strcmp(buf, "1979-05-27T07:32:00Z") == 0);
+
+	node = toml_get(root, "local");
+	CU_ASSERT_FATAL(node != NULL);
+	CU_ASSERT(node->value.rfc3339_time.epoch == 296638320);
+	CU_ASSERT(node->value.rfc3339_time.sec_frac == 999999999);
+	CU_ASSERT(toml_format_date(node, buf, sizeof(buf)) == 35);
+	CU_ASSERT(strcmp(buf, "1979-05-27T00:32:00.999999999-07:00") == 0);
+
+	/* truncated like snprintf */
+	CU_ASSERT(toml_format_date(node, buf, 11) == 35);
+	CU_ASSERT(strcmp(buf, "1979-05-27") == 0);
+
+	node = toml_get(root, "early");
+	CU_ASSERT_FATAL(node != NULL);
+	CU_ASSERT(node->value.rfc3339_time.epoch == -11676099600LL);
+	toml_format_date(node, buf, sizeof(buf));
+	CU_ASSERT(strcmp(buf, "1600-01-01T00:00:00+01:00") == 0);
+
+	toml_free(root);
+
+	for (i = 0; i < ARRAY_LENGTH(bad); i++) {
+		toml_init(&root);
+		CU_ASSERT(toml_parse(root, bad[i], strlen(bad[i])) != 0);
+		toml_free(root);
+	}
+}
+
 static void
 testInlineTable(void)
 {
@@ -477,54 +633,1435 @@ testBadExamples(void)
 	mmapAndParse("examples/text_in_array.toml", 1);
 }
 
-int main(void)
+static void
+testArena(void)
 {
-	CU_pSuite pSuite = NULL;
+	int					ret;
+	struct toml_node*	root;
+	struct toml_node*	node;
+	char*				doc = "title = \"arena\"\n[owner]\nname = \"Tom\"\n[[fruit]]\nname = \"apple\"\n[[fruit]]\nname = \"banana\"\n[clients]\ndata = [ [\"gamma\", \"delta\"], [1, 2] ]\n";
 
-	if (CUE_SUCCESS != CU_initialize_registry())
-		return CU_get_error();
+	ret = toml_init_arena(&root);
+	CU_ASSERT_FATAL(ret == 0);
 
-	pSuite = CU_add_suite("toml suite", init_toml, fini_toml);
-	if (NULL == pSuite)
-		goto out;
+	ret = toml_parse(root, doc, strlen(doc));
+	CU_ASSERT(ret == 0);
 
-	if ((NULL == CU_add_test(pSuite, "test fruit", testFruit)))
-		goto out;
+	node = toml_get(root, "owner.name");
+	CU_ASSERT_FATAL(node != NULL);
+	CU_ASSERT(node->type == TOML_STRING);
+	CU_ASSERT(strcmp(node->value.string, "Tom") == 0);
 
-	if ((NULL == CU_add_test(pSuite, "test types", testTypes)))
-		goto out;
+	node = toml_get(root, "fruit");
+	CU_ASSERT_FATAL(node != NULL);
+	CU_ASSERT(node->type == TOML_TABLE_ARRAY);
 
-	if ((NULL == CU_add_test(pSuite, "test numbers", testNumbers)))
-		goto out;
+	node = toml_get(root, "clients.data");
+	CU_ASSERT_FATAL(node != NULL);
+	CU_ASSERT(node->type == TOML_LIST);
 
-	if ((NULL == CU_add_test(pSuite, "test good examples", testGoodExamples)))
-		goto out;
+	toml_free(root);
+}
 
-	if ((NULL == CU_add_test(pSuite, "test bad examples", testBadExamples)))
-		goto out;
+static void
+testWideTable(void)
+{
+	int					ret, i, len = 0;
+	struct toml_node*	root;
+	struct toml_node*	node;
+	char				key[32];
+	char*				wide = malloc(1000 * 32);
 
-	if ((NULL == CU_add_test(pSuite, "test UTF16", testUTF16)))
-		goto out;
+	CU_ASSERT_FATAL(wide != NULL);
 
-	if ((NULL == CU_add_test(pSuite, "test UTF32", testUTF32)))
-		goto out;
+	len += sprintf(wide + len, "[wide]\n");
+	for (i = 0; i < 1000; i++)
+		len += sprintf(wide + len, "key%d = %d\n", i, i);
 
-	if ((NULL == CU_add_test(pSuite, "test literal string", testLiteralString)))
-		goto out;
+	toml_init(&root);
+	ret = toml_parse(root, wide, len);
+	CU_ASSERT(ret == 0);
 
-	if ((NULL == CU_add_test(pSuite, "test literal multi-line string", testLiteralMultiLineString)))
-		goto out;
+	for (i = 0; i < 1000; i += 97) {
+		sprintf(key, "wide.key%d", i);
+		node = toml_get(root, key);
+		CU_ASSERT_FATAL(node != NULL);
+		CU_ASSERT(node->type == TOML_INT);
+		CU_ASSERT(node->value.integer == i);
+	}
+	CU_ASSERT(toml_get(root, "wide.key1000") == NULL);
+	toml_free(root);
 
-	if ((NULL == CU_add_test(pSuite, "test basic multi-line string", testMultiLine)))
-		goto out;
+	/* a duplicate at the end of a big table must still be spotted */
+	len += sprintf(wide + len, "key500 = 1\n");
+	toml_init(&root);
+	ret = toml_parse(root, wide, len);
+	CU_ASSERT(ret != 0);
+	toml_free(root);
 
-	if ((NULL == CU_add_test(pSuite, "test RFC3339 dates", testRFC3339)))
-		goto out;
+	/* keys which are prefixes of each other are not duplicates */
+	len = sprintf(wide, "ab = 1\na = 2\n");
+	toml_init(&root);
+	ret = toml_parse(root, wide, len);
+	CU_ASSERT(ret == 0);
+	toml_free(root);
 
-	if ((NULL == CU_add_test(pSuite, "test inline table", testInlineTable)))
-		goto out;
+	free(wide);
+}
 
-	if ((NULL == CU_add_test(pSuite, "test junk inputs", testJunkInputs)))
+static void
+testBorrowed(void)
+{
+	int						ret;
+	struct toml_node*		root;
+	struct toml_node*		node;
+	struct toml_parse_opts	opts = { .flags = TOML_PARSE_BORROW };
+	char					doc[] = "plain = \"view\"\nescaped = \"a\\tb\"\n"
+									"multi = \"\"\"\nline \\\n   joined\"\"\"\n"
+									"[table]\nliteral = 'C:\\path'\n";
+
+	toml_init(&root);
+	ret = toml_parse_with_opts(root, doc, strlen(doc), &opts);
+	CU_ASSERT_FATAL(ret == 0);
+
+	/* no escapes, so the value is a view of the input */
+	node = toml_get(root, "plain");
+	CU_ASSERT_FATAL(node != NULL);
+	CU_ASSERT(node->value.string >= doc && node->value.string < doc + sizeof(doc));
+	CU_ASSERT(node->value.string_len == 4);
+	CU_ASSERT(memcmp(node->value.string, "view", 4) == 0);
+	CU_ASSERT(node->name >= doc && node->name < doc + sizeof(doc));
+	CU_ASSERT(node->name_len == 5);
+
+	node = toml_get(root, "escaped");
+	CU_ASSERT_FATAL(node != NULL);
+	CU_ASSERT(node->value.string < doc || node->value.string >= doc + sizeof(doc));
+	CU_ASSERT(node->value.string_len == 3);
+	CU_ASSERT(memcmp(node->value.string, "a\tb", 3) == 0);
+
+	node = toml_get(root, "multi");
+	CU_ASSERT_FATAL(node != NULL);
+	CU_ASSERT(node->value.string_len == 11);
+	CU_ASSERT(memcmp(node->value.string, "line joined", 11) == 0);
+
+	node = toml_get(root, "table.literal");
+	CU_ASSERT_FATAL(node != NULL);
+	CU_ASSERT(node->value.string_len == 7);
+	CU_ASSERT(memcmp(node->value.string, "C:\\path", 7) == 0);
+
+	toml_free(root);
+}
+
+static char*
+jsonOf(struct toml_node* root)
+{
+	FILE*	f = tmpfile();
+	long	len;
+	char*	json;
+
+	CU_ASSERT_FATAL(f != NULL);
+	toml_tojson(root, f);
+	len = ftell(f);
+	json = calloc(1, len + 1);
+	CU_ASSERT_FATAL(json != NULL);
+	rewind(f);
+	CU_ASSERT(fread(json, 1, len, f) == (size_t)len);
+	fclose(f);
+
+	return json;
+}
+
+static void
+testChunked(void)
+{
+	int					ret, fd;
+	struct toml_node*	root;
+	struct toml_node*	node;
+	struct stat			st;
+	char*				m;
+	char*				whole;
+	char*				chunked;
+	size_t				sizes[] = { 1, 2, 7, 64, 4097 };
+	size_t				i, off;
+	char*				tail = "a = \"x\\u00e9y\"\nn = 12";
+
+	fd = open("examples/hard_example.toml", O_RDONLY);
+	CU_ASSERT_FATAL(fd != -1);
+	ret = fstat(fd, &st);
+	CU_ASSERT_FATAL(ret != -1);
+	m = mmap(NULL, st.st_size, PROT_READ, MAP_FILE|MAP_PRIVATE, fd, 0);
+	CU_ASSERT_FATAL(m != MAP_FAILED);
+
+	toml_init(&root);
+	ret = toml_parse(root, m, st.st_size);
+	CU_ASSERT_FATAL(ret == 0);
+	whole = jsonOf(root);
+	toml_free(root);
+
+	/* however the input is cut up the document comes out the same */
+	for (i = 0; i < ARRAY_LENGTH(sizes); i++) {
+		toml_init(&root);
+		for (off = 0; off < (size_t)st.st_size; off += sizes[i]) {
+			size_t len = st.st_size - off < sizes[i] ? st.st_size - off : sizes[i];
+
+			ret = toml_parse_chunk(root, m + off, len);
+			CU_ASSERT_FATAL(ret == 0);
+		}
+		ret = toml_parse_finish(root);
+		CU_ASSERT_FATAL(ret == 0);
+
+		chunked = jsonOf(root);
+		CU_ASSERT(strcmp(whole, chunked) == 0);
+		free(chunked);
+		toml_free(root);
+	}
+
+	free(whole);
+	munmap(m, st.st_size);
+	close(fd);
+
+	/* the last token is only complete once the parse is finished */
+	toml_init(&root);
+	for (off = 0; off < strlen(tail); off++)
+		CU_ASSERT(toml_parse_chunk(root, tail + off, 1) == 0);
+	CU_ASSERT(toml_get(root, "n") == NULL);
+	CU_ASSERT(toml_parse_finish(root) == 0);
+
+	node = toml_get(root, "a");
+	CU_ASSERT_FATAL(node != NULL);
+	CU_ASSERT(node->value.string_len == 4);
+	CU_ASSERT(memcmp(node->value.string, "x\xc3\xa9y", 4) == 0);
+	node = toml_get(root, "n");
+	CU_ASSERT_FATAL(node != NULL);
+	CU_ASSERT(node->value.integer == 12);
+	toml_free(root);
+
+	/* an error sticks, and an unfinished parse can still be freed */
+	toml_init(&root);
+	CU_ASSERT(toml_parse_chunk(root, "a = ]", 5) != 0);
+	CU_ASSERT(toml_parse_chunk(root, "\nb = 1\n", 7) != 0);
+	toml_free(root);
+
+	toml_init(&root);
+	CU_ASSERT(toml_parse_chunk(root, "a = \"open", 10) == 0);
+	CU_ASSERT(toml_parse_finish(root) != 0);
+	toml_free(root);
+}
+
+static int
+traceTable(void* ctx, const char* name, size_t len)
+{
+	sprintf((char*)ctx + strlen(ctx), "[%.*s] ", (int)len, name);
+	return 0;
+}
+
+static int
+traceTableArray(void* ctx, const char* name, size_t len)
+{
+	sprintf((char*)ctx + strlen(ctx), "[[%.*s]] ", (int)len, name);
+	return 0;
+}
+
+static int
+traceKey(void* ctx, const char* name, size_t len)
+{
+	sprintf((char*)ctx + strlen(ctx), "%.*s= ", (int)len, name);
+	return 0;
+}
+
+static int
+traceValue(void* ctx, enum toml_type type, const char* raw, size_t len)
+{
+	sprintf((char*)ctx + strlen(ctx), "%d:%.*s ", type, (int)len, raw);
+	return 0;
+}
+
+static int
+traceBeginArray(void* ctx)
+{
+	strcat(ctx, "( ");
+	return 0;
+}
+
+static int
+traceEndArray(void* ctx)
+{
+	strcat(ctx, ") ");
+	return 0;
+}
+
+static int
+traceBeginInline(void* ctx)
+{
+	strcat(ctx, "{ ");
+	return 0;
+}
+
+static int
+traceEndInline(void* ctx)
+{
+	strcat(ctx, "} ");
+	return 0;
+}
+
+static int
+stopAtKey(void* ctx, const char* name, size_t len)
+{
+	return 42;
+}
+
+static void
+testEvents(void)
+{
+	int					ret;
+	char				trace[1024] = "";
+	struct toml_events	events = {
+		.begin_table = traceTable,
+		.begin_table_array = traceTableArray,
+		.key = traceKey,
+		.value = traceValue,
+		.begin_array = traceBeginArray,
+		.end_array = traceEndArray,
+		.begin_inline_table = traceBeginInline,
+		.end_inline_table = traceEndInline,
+	};
+	struct toml_events	stop = { .key = stopAtKey };
+	char*				doc = "title = \"TOML\"\n[owner]\nname = \"Tom \\\"P\\\"\"\n"
+							"dob = 1979-05-27T07:32:00Z\n[[fruit]]\n"
+							"list = [ [1, 2], [\"a\"] ]\n"
+							"point = { x = 1.5, y = true }\n";
+
+	ret = toml_parse_events(doc, strlen(doc), &events, trace);
+	CU_ASSERT(ret == 0);
+	CU_ASSERT(strcmp(trace, "title= 6:TOML [owner] name= 6:Tom \"P\" "
+							"dob= 7:1979-05-27T07:32:00Z [[fruit]] "
+							"list= ( ( 4:1 4:2 ) ( 6:a ) ) "
+							"point= { x= 5:1.5 y= 8:true } ") == 0);
+
+	/* a handler can stop the parse */
+	ret = toml_parse_events(doc, strlen(doc), &stop, NULL);
+	CU_ASSERT(ret == 42);
+
+	/* bad input is still caught */
+	ret = toml_parse_events("a = [1, \"b\"]\n", 13, &events, trace);
+	CU_ASSERT(ret == 1);
+}
+
+struct bindEndpoint {
+	char	host[32];
+	int32_t	port;
+};
+
+struct bindConfig {
+	char					title[16];
+	int64_t					retries;
+	double					ratio;
+	bool					verbose;
+	struct toml_datetime	since;
+	struct bindEndpoint		primary;
+	struct bindEndpoint		mirrors[4];
+	size_t					nmirrors;
+};
+
+static const struct toml_binding bindEndpointFields[] = {
+	{ "host", TOML_BIND_STRING, offsetof(struct bindEndpoint, host), 32 },
+	{ "port", TOML_BIND_INT, offsetof(struct bindEndpoint, port), 4 },
+	{ NULL }
+};
+
+static const struct toml_binding bindConfigFields[] = {
+	{ "title", TOML_BIND_STRING, offsetof(struct bindConfig, title), 16 },
+	{ "limits.retries", TOML_BIND_INT, offsetof(struct bindConfig, retries), 8 },
+	{ "limits.ratio", TOML_BIND_DOUBLE, offsetof(struct bindConfig, ratio), sizeof(double) },
+	{ "verbose", TOML_BIND_BOOL, offsetof(struct bindConfig, verbose), sizeof(bool) },
+	{ "since", TOML_BIND_DATE, offsetof(struct bindConfig, since), sizeof(struct toml_datetime) },
+	{ "primary", TOML_BIND_TABLE, offsetof(struct bindConfig, primary), 0, bindEndpointFields },
+	{ "mirror", TOML_BIND_TABLE_ARRAY, offsetof(struct bindConfig, mirrors),
+		sizeof(((struct bindConfig*)0)->mirrors), bindEndpointFields,
+		sizeof(struct bindEndpoint), offsetof(struct bindConfig, nmirrors) },
+	{ NULL }
+};
+
+/* Values land in the structures described, no tree in between */
+static void
+testBind(void)
+{
+	int					ret;
+	struct bindConfig	config;
+	char				doc[512];
+	char*				toml =
+		"title = \"bound\"\n"
+		"verbose = true\n"
+		"since = 1979-05-27T07:32:00Z\n"
+		"unbound = 1\n"
+		"[limits]\n"
+		"retries = 3\n"
+		"ratio = 0.5\n"
+		"[primary]\n"
+		"host = \"a.example\"\n"
+		"port = 80\n"
+		"[[mirror]]\n"
+		"host = \"b.example\"\n"
+		"[[mirror]]\n"
+		"host = \"c.example\"\n"
+		"port = 8080\n";
+
+	memset(&config, 0, sizeof(config));
+	strcpy(doc, toml);
+	ret = toml_bind(doc, strlen(doc), bindConfigFields, &config, 0);
+	CU_ASSERT_FATAL(ret == 0);
+
+	CU_ASSERT(strcmp(config.title, "bound") == 0);
+	CU_ASSERT(config.verbose);
+	CU_ASSERT(config.since.epoch == 296638320);
+	CU_ASSERT(config.since.zulu);
+	CU_ASSERT(config.retries == 3);
+	CU_ASSERT(config.ratio == 0.5);
+	CU_ASSERT(strcmp(config.primary.host, "a.example") == 0);
+	CU_ASSERT(config.primary.port == 80);
+	CU_ASSERT(config.nmirrors == 2);
+	CU_ASSERT(strcmp(config.mirrors[0].host, "b.example") == 0);
+	CU_ASSERT(strcmp(config.mirrors[1].host, "c.example") == 0);
+	CU_ASSERT(config.mirrors[1].port == 8080);
+
+	/* keys nobody asked for */
+	memset(&config, 0, sizeof(config));
+	strcpy(doc, toml);
+	ret = toml_bind(doc, strlen(doc), bindConfigFields, &config, TOML_BIND_STRICT);
+	CU_ASSERT(ret == ENOENT);
+
+	/* values that do not fit */
+	memset(&config, 0, sizeof(config));
+	strcpy(doc, "title = 1\n");
+	CU_ASSERT(toml_bind(doc, strlen(doc), bindConfigFields, &config, 0) == EINVAL);
+	strcpy(doc, "title = \"far too long for it\"\n");
+	CU_ASSERT(toml_bind(doc, strlen(doc), bindConfigFields, &config, 0) == ERANGE);
+	strcpy(doc, "mirror = [ {}, {}, {}, {}, {} ]\n");
+	CU_ASSERT(toml_bind(doc, strlen(doc), bindConfigFields, &config, 0) == ERANGE);
+}
+
+static void
+testCompiledPath(void)
+{
+	int					ret, i;
+	struct toml_node*	root;
+	struct toml_node*	node;
+	struct toml_path*	path;
+	char*				doc = "[a.b]\nc = 1\n\"d.e\" = 2\n[f]\ng = [ 1 ]\n";
+	char*				paths[] = { "a.b.c", "a.b.\"d.e\"", "a.b.'d.e'", "f.g" };
+	int					values[] = { 1, 2, 2, 0 };
+
+	toml_init(&root);
+	ret = toml_parse(root, doc, strlen(doc));
+	CU_ASSERT_FATAL(ret == 0);
+
+	for (i = 0; i < ARRAY_LENGTH(paths); i++) {
+		path = toml_path_compile(paths[i]);
+		CU_ASSERT_FATAL(path != NULL);
+
+		node = toml_get_compiled(root, path);
+		CU_ASSERT_FATAL(node != NULL);
+		CU_ASSERT(node == toml_get(root, paths[i]));
+		if (node->type == TOML_INT)
+			CU_ASSERT(node->value.integer == values[i]);
+
+		toml_path_free(path);
+	}
+
+	/* a path can be resolved from any table, not just the root */
+	path = toml_path_compile("b.c");
+	CU_ASSERT_FATAL(path != NULL);
+	CU_ASSERT(toml_get_compiled(toml_get(root, "a"), path) == toml_get(root, "a.b.c"));
+	CU_ASSERT(toml_get_compiled(root, path) == NULL);
+	toml_path_free(path);
+
+	path = toml_path_compile("a.b.c.d");
+	CU_ASSERT_FATAL(path != NULL);
+	CU_ASSERT(toml_get_compiled(root, path) == NULL);
+	toml_path_free(path);
+
+	CU_ASSERT(toml_path_compile("a.\"b") == NULL);
+	CU_ASSERT(toml_path_compile("a.\"b\"c") == NULL);
+
+	toml_free(root);
+}
+
+static void
+testNumberValues(void)
+{
+	int					ret, i;
+	struct toml_node*	root;
+	struct toml_node*	node;
+	char				doc[128];
+	char*				ints[] = { "0", "1_000", "-42", "9223372036854775807",
+									"-9223372036854775808", "+7" };
+	int64_t				int_values[] = { 0, 1000, -42, INT64_MAX, INT64_MIN, 7 };
+	char*				bad_ints[] = { "9223372036854775808",
+									"-9223372036854775809", "12345678901234567890123" };
+	char*				floats[] = { "1_000.5", "0.1", "-0.0", "1e10", "6.02e+23",
+					"1.7976931348623157e308", "4.9e-324", "2.2250738585072011e-308",
+					"3.141592653589793238462643383279", "1E-7", "123456.789e-2_0",
+					"9007199254740993.0", "0.000000000000000000000000000001" };
+	double				float_values[] = { 1000.5, 0.1, -0.0, 1e10, 6.02e23,
+					1.7976931348623157e308, 4.9e-324, 2.2250738585072011e-308,
+					3.141592653589793238462643383279, 1e-7, 123456.789e-20,
+					9007199254740993.0, 1e-30 };
+
+	for (i = 0; i < ARRAY_LENGTH(ints); i++) {
+		snprintf(doc, sizeof(doc), "n = %s\n", ints[i]);
+		toml_init(&root);
+		ret = toml_parse(root, doc, strlen(doc));
+		CU_ASSERT_FATAL(ret == 0);
+		node = toml_get(root, "n");
+		CU_ASSERT_FATAL(node != NULL && node->type == TOML_INT);
+		CU_ASSERT(node->value.integer == int_values[i]);
+		toml_free(root);
+	}
+
+	for (i = 0; i < ARRAY_LENGTH(bad_ints); i++) {
+		snprintf(doc, sizeof(doc), "n = %s\n", bad_ints[i]);
+		toml_init(&root);
+		ret = toml_parse(root, doc, strlen(doc));
+		CU_ASSERT(ret != 0);
+		toml_free(root);
+	}
+
+	/* every one of these must be the correctly rounded double */
+	for (i = 0; i < ARRAY_LENGTH(floats); i++) {
+		snprintf(doc, sizeof(doc), "f = %s\n", floats[i]);
+		toml_init(&root);
+		ret = toml_parse(root, doc, strlen(doc));
+		CU_ASSERT_FATAL(ret == 0);
+		node = toml_get(root, "f");
+		CU_ASSERT_FATAL(node != NULL && node->type == TOML_FLOAT);
+		CU_ASSERT(memcmp(&node->value.floating.value, &float_values[i],
+											sizeof(double)) == 0);
+		toml_free(root);
+	}
+
+	toml_init(&root);
+	ret = toml_parse(root, "f = 1.5e\n", 9);
+	CU_ASSERT(ret != 0);
+	toml_free(root);
+}
+
+static int
+collect(void* ctx, const char* buf, size_t len)
+{
+	FILE* f = ctx;
+
+	return fwrite(buf, 1, len, f) == len ? 0 : -1;
+}
+
+static int
+refuse(void* ctx, const char* buf, size_t len)
+{
+	return 42;
+}
+
+static void
+testWriter(void)
+{
+	int					ret, fd;
+	struct toml_node*	root;
+	struct toml_writer*	w;
+	struct stat			st;
+	char*				m;
+	char*				json;
+	const char*			data;
+	size_t				len;
+	FILE*				f;
+
+	fd = open("examples/hard_example.toml", O_RDONLY);
+	CU_ASSERT_FATAL(fd != -1);
+	ret = fstat(fd, &st);
+	CU_ASSERT_FATAL(ret != -1);
+	m = mmap(NULL, st.st_size, PROT_READ, MAP_FILE|MAP_PRIVATE, fd, 0);
+	CU_ASSERT_FATAL(m != MAP_FAILED);
+
+	toml_init(&root);
+	ret = toml_parse(root, m, st.st_size);
+	CU_ASSERT_FATAL(ret == 0);
+	json = jsonOf(root);
+
+	w = toml_writer_buffer();
+	CU_ASSERT_FATAL(w != NULL);
+	ret = toml_tojson_to(root, w);
+	CU_ASSERT(ret == 0);
+	data = toml_writer_data(w, &len);
+	CU_ASSERT(len == strlen(json));
+	CU_ASSERT(memcmp(data, json, len) == 0);
+	ret = toml_writer_free(w);
+	CU_ASSERT(ret == 0);
+
+	f = tmpfile();
+	CU_ASSERT_FATAL(f != NULL);
+	w = toml_writer_fd(fileno(f));
+	CU_ASSERT_FATAL(w != NULL);
+	ret = toml_tojson_to(root, w);
+	CU_ASSERT(ret == 0);
+	ret = toml_writer_free(w);
+	CU_ASSERT(ret == 0);
+	CU_ASSERT(lseek(fileno(f), 0, SEEK_END) == (off_t)strlen(json));
+	fclose(f);
+
+	f = tmpfile();
+	CU_ASSERT_FATAL(f != NULL);
+	w = toml_writer_callback(collect, f);
+	CU_ASSERT_FATAL(w != NULL);
+	ret = toml_tojson_to(root, w);
+	CU_ASSERT(ret == 0);
+	ret = toml_writer_free(w);
+	CU_ASSERT(ret == 0);
+	CU_ASSERT(ftell(f) == (long)strlen(json));
+	fclose(f);
+
+	/* the first error from the callback is kept */
+	w = toml_writer_callback(refuse, NULL);
+	CU_ASSERT_FATAL(w != NULL);
+	ret = toml_tojson_to(root, w);
+	CU_ASSERT(ret == 42);
+	ret = toml_writer_free(w);
+	CU_ASSERT(ret == 42);
+
+	free(json);
+	toml_free(root);
+	munmap(m, st.st_size);
+	close(fd);
+}
+
+/* Strings long enough to be scanned in blocks, interrupted everywhere */
+static void
+testLongStrings(void)
+{
+	int					ret;
+	struct toml_node*	root;
+	struct toml_node*	node;
+	char				doc[512], body[128];
+	char*				forms[] = {
+		"s = \"%.*s\\t%s\"\n",
+		"s = '%.*s\\t%s'\n",
+		"s = \"\"\"\n%.*s\\t%s\"\"\"\n",
+		"s = '''%.*s\\t%s'''\n",
+	};
+	char*				expect[] = { "\t", "\\t", "\t", "\\t" };
+	size_t				len, at, i;
+
+	memset(body, 'x', sizeof(body) - 1);
+	body[sizeof(body) - 1] = '\0';
+
+	for (i = 0; i < ARRAY_LENGTH(forms); i++) {
+		/* only multi-line strings may have newlines in them */
+		for (at = 0; at < sizeof(body) - 1; at += 13)
+			body[at] = i >= 2 && at % 2 ? '\n' : '#';
+
+		for (at = 0; at < 100; at++) {
+			snprintf(doc, sizeof(doc), forms[i], (int)at, body, body + at);
+
+			toml_init(&root);
+			ret = toml_parse(root, doc, strlen(doc));
+			CU_ASSERT_FATAL(ret == 0);
+
+			node = toml_get(root, "s");
+			CU_ASSERT_FATAL(node != NULL && node->type == TOML_STRING);
+
+			len = strlen(expect[i]);
+			CU_ASSERT(node->value.string_len == sizeof(body) - 1 + len);
+			CU_ASSERT(memcmp(node->value.string, body, at) == 0);
+			CU_ASSERT(memcmp(node->value.string + at, expect[i], len) == 0);
+			CU_ASSERT(memcmp(node->value.string + at + len, body + at,
+										sizeof(body) - 1 - at) == 0);
+			toml_free(root);
+		}
+	}
+}
+
+/* Escaped strings far bigger than any fixed buffer, one after another */
+static void
+testHugeStrings(void)
+{
+	struct toml_node*	root;
+	struct toml_node*	node;
+	size_t				lines = 64 * 1024, i, off = 0;
+	char*				doc = malloc(2 * lines * 40 + 64);
+	char*				expect = malloc(lines * 40);
+	char				name[2] = "a";
+
+	CU_ASSERT_FATAL(doc != NULL && expect != NULL);
+
+	/* a and c are built up from escapes, b in between needs none */
+	for (name[0] = 'a'; name[0] <= 'c'; name[0]++) {
+		off += sprintf(doc + off, "%s = \"", name);
+		for (i = 0; name[0] != 'b' && i < lines; i++)
+			off += sprintf(doc + off, "-----BEGIN \\u00e9 %06zu-----\\n", i);
+		off += sprintf(doc + off, "%s\"\n", name[0] == 'b' ? "plain" : "");
+	}
+
+	toml_init(&root);
+	CU_ASSERT_FATAL(toml_parse(root, doc, off) == 0);
+
+	for (i = 0, off = 0; i < lines; i++)
+		off += sprintf(expect + off, "-----BEGIN \xc3\xa9 %06zu-----\n", i);
+
+	node = toml_get(root, "a");
+	CU_ASSERT_FATAL(node != NULL && node->type == TOML_STRING);
+	CU_ASSERT(node->value.string_len == off);
+	CU_ASSERT(memcmp(node->value.string, expect, off) == 0);
+
+	node = toml_get(root, "b");
+	CU_ASSERT_FATAL(node != NULL && node->type == TOML_STRING);
+	CU_ASSERT(node->value.string_len == 5);
+	CU_ASSERT(memcmp(node->value.string, "plain", 5) == 0);
+
+	node = toml_get(root, "c");
+	CU_ASSERT_FATAL(node != NULL && node->type == TOML_STRING);
+	CU_ASSERT(node->value.string_len == off);
+	CU_ASSERT(memcmp(node->value.string, expect, off) == 0);
+
+	toml_free(root);
+	free(expect);
+	free(doc);
+}
+
+/* Values read back as they are stored, nothing allocated */
+static void
+testAccessors(void)
+{
+	int						ret;
+	struct toml_node*		root;
+	struct toml_node*		flat;
+	struct toml_node*		doc;
+	struct toml_datetime	date;
+	int64_t					i;
+	double					d;
+	bool					b;
+	const char*				str;
+	size_t					len;
+	char*					toml =
+		"[server]\n"
+		"port = -8080\n"
+		"load = 0.75\n"
+		"up = true\n"
+		"motd = \"hi\\tthere\"\n"
+		"since = 1979-05-27T00:32:00.5-07:00\n"
+		"at = 1979-05-27T07:32:00Z\n";
+
+	toml_init(&root);
+	ret = toml_parse(root, toml, strlen(toml));
+	CU_ASSERT_FATAL(ret == 0);
+	ret = toml_flatten(root, &flat);
+	CU_ASSERT_FATAL(ret == 0);
+
+	for (doc = root; doc; doc = doc == root ? flat : NULL) {
+		CU_ASSERT(toml_get_int64(toml_get(doc, "server.port"), &i));
+		CU_ASSERT(i == -8080);
+		CU_ASSERT(!toml_get_int64(toml_get(doc, "server.load"), &i));
+		CU_ASSERT(!toml_get_int64(toml_get(doc, "server.nope"), &i));
+
+		CU_ASSERT(toml_get_double(toml_get(doc, "server.load"), &d));
+		CU_ASSERT(d == 0.75);
+
+		CU_ASSERT(toml_get_bool(toml_get(doc, "server.up"), &b));
+		CU_ASSERT(b);
+
+		str = toml_get_string(toml_get(doc, "server.motd"), &len);
+		CU_ASSERT_FATAL(str != NULL);
+		CU_ASSERT(len == 8 && memcmp(str, "hi\tthere", len) == 0);
+		CU_ASSERT(toml_get_string(toml_get(doc, "server.up"), &len) == NULL);
+
+		CU_ASSERT(toml_get_datetime(toml_get(doc, "server.since"), &date));
+		CU_ASSERT(date.epoch == 296638320);
+		CU_ASSERT(date.nsec == 500000000);
+		CU_ASSERT(date.offset == -7 * 60);
+		CU_ASSERT(!date.zulu);
+		CU_ASSERT(toml_get_datetime(toml_get(doc, "server.at"), &date));
+		CU_ASSERT(date.epoch == 296638320);
+		CU_ASSERT(date.nsec == 0);
+		CU_ASSERT(date.zulu);
+
+		str = toml_name_view(toml_get(doc, "server"), &len);
+		CU_ASSERT(len == 6 && memcmp(str, "server", len) == 0);
+		CU_ASSERT(toml_name_view(doc, &len) == NULL);
+	}
+
+	toml_free(flat);
+	toml_free(root);
+}
+
+/* Looking keys up together finds what looking them up one by one does */
+static void
+testGetMany(void)
+{
+	int					ret, i;
+	struct toml_node*	root;
+	struct toml_node*	nodes[8];
+	const char*			keys[8] = {
+		"services.payments.port",
+		"services.auth.port",
+		"services.payments.host",
+		"services.payments",
+		"services.payments.nope",
+		"nope.payments.port",
+		"\"services\".auth.host",
+		"services.auth.port",
+	};
+	char*				toml =
+		"[services.auth]\n"
+		"host = \"auth.local\"\n"
+		"port = 8081\n"
+		"[services.payments]\n"
+		"host = \"pay.local\"\n"
+		"port = 8082\n";
+
+	toml_init(&root);
+	ret = toml_parse(root, toml, strlen(toml));
+	CU_ASSERT_FATAL(ret == 0);
+
+	ret = toml_get_many(root, keys, 8, nodes);
+	CU_ASSERT_FATAL(ret == 0);
+
+	for (i = 0; i < 8; i++)
+		CU_ASSERT(nodes[i] == toml_get(root, (char*)keys[i]));
+	CU_ASSERT(nodes[0] != NULL);
+	CU_ASSERT(nodes[4] == NULL);
+	CU_ASSERT(nodes[5] == NULL);
+	CU_ASSERT(nodes[6] != NULL);
+	CU_ASSERT(nodes[1] == nodes[7]);
+
+	toml_free(root);
+}
+
+static void
+countNodes(struct toml_node* node, void* ctx)
+{
+	(*(int*)ctx)++;
+}
+
+/* A flattened document reads as the tree it was made from */
+static void
+testFlatten(void)
+{
+	int					ret, fd;
+	int					tree_nodes = 0, flat_nodes = 0;
+	struct toml_node*	root;
+	struct toml_node*	flat;
+	struct toml_node*	copy;
+	struct toml_node*	node;
+	struct stat			st;
+	char*				m;
+	char*				json;
+	char*				flat_json;
+	char*				name;
+
+	fd = open("examples/hard_example.toml", O_RDONLY);
+	CU_ASSERT_FATAL(fd != -1);
+	ret = fstat(fd, &st);
+	CU_ASSERT_FATAL(ret != -1);
+	m = mmap(NULL, st.st_size, PROT_READ, MAP_FILE|MAP_PRIVATE, fd, 0);
+	CU_ASSERT_FATAL(m != MAP_FAILED);
+
+	toml_init(&root);
+	ret = toml_parse(root, m, st.st_size);
+	CU_ASSERT_FATAL(ret == 0);
+
+	ret = toml_flatten(root, &flat);
+	CU_ASSERT_FATAL(ret == 0);
+
+	json = jsonOf(root);
+	flat_json = jsonOf(flat);
+	CU_ASSERT(strcmp(json, flat_json) == 0);
+	free(json);
+	free(flat_json);
+
+	toml_walk(root, countNodes, &tree_nodes);
+	toml_walk(flat, countNodes, &flat_nodes);
+	CU_ASSERT(tree_nodes == flat_nodes);
+	flat_nodes = 0;
+	toml_dive(flat, countNodes, &flat_nodes);
+	CU_ASSERT(tree_nodes == flat_nodes);
+
+	node = toml_get(flat, "the.hard.bit.what?");
+	CU_ASSERT_FATAL(node != NULL);
+	CU_ASSERT(toml_type(node) == TOML_STRING);
+	name = toml_name(node);
+	CU_ASSERT(strcmp(name, "what?") == 0);
+	free(name);
+
+	/* it is read only */
+	CU_ASSERT(toml_flatten(flat, &copy) == EINVAL);
+
+	toml_free(flat);
+	toml_free(root);
+	munmap(m, st.st_size);
+	close(fd);
+}
+
+/* A snapshot answers as the document it was taken of */
+static void
+testSnapshot(void)
+{
+	int					ret, fd;
+	struct toml_node*	root;
+	struct toml_node*	snap;
+	struct toml_node*	node;
+	struct stat			st;
+	char*				m;
+	char*				json;
+	char*				snap_json;
+	char*				value;
+	char				path[] = "/tmp/libtoml-test.XXXXXX";
+	char				doc[4096];
+	size_t				off = 0;
+	int					i;
+
+	fd = open("examples/hard_example.toml", O_RDONLY);
+	CU_ASSERT_FATAL(fd != -1);
+	ret = fstat(fd, &st);
+	CU_ASSERT_FATAL(ret != -1);
+	m = mmap(NULL, st.st_size, PROT_READ, MAP_FILE|MAP_PRIVATE, fd, 0);
+	CU_ASSERT_FATAL(m != MAP_FAILED);
+
+	toml_init(&root);
+	ret = toml_parse(root, m, st.st_size);
+	CU_ASSERT_FATAL(ret == 0);
+	munmap(m, st.st_size);
+	close(fd);
+
+	fd = mkstemp(path);
+	CU_ASSERT_FATAL(fd != -1);
+	close(fd);
+
+	ret = toml_save_snapshot(root, path);
+	CU_ASSERT_FATAL(ret == 0);
+	ret = toml_open_snapshot(path, &snap);
+	CU_ASSERT_FATAL(ret == 0);
+
+	json = jsonOf(root);
+	snap_json = jsonOf(snap);
+	CU_ASSERT(strcmp(json, snap_json) == 0);
+	free(json);
+	free(snap_json);
+
+	node = toml_get(snap, "the.hard.harder_test_string");
+	CU_ASSERT_FATAL(node != NULL);
+	CU_ASSERT(toml_type(node) == TOML_STRING);
+	value = toml_value_as_string(node);
+	CU_ASSERT(strcmp(value, " And when \\\"'s are in the string, along with # \\\"") == 0);
+	free(value);
+
+	toml_free(snap);
+	toml_free(root);
+
+	/* a table big enough to be indexed */
+	for (i = 0; i < 100; i++)
+		off += sprintf(doc + off, "key%d = %d\n", i, i);
+
+	toml_init(&root);
+	ret = toml_parse(root, doc, off);
+	CU_ASSERT_FATAL(ret == 0);
+	ret = toml_save_snapshot(root, path);
+	CU_ASSERT_FATAL(ret == 0);
+	toml_free(root);
+
+	ret = toml_open_snapshot(path, &snap);
+	CU_ASSERT_FATAL(ret == 0);
+	for (i = 0; i < 100; i++) {
+		sprintf(doc, "key%d", i);
+		node = toml_get(snap, doc);
+		CU_ASSERT_FATAL(node != NULL);
+		value = toml_value_as_string(node);
+		CU_ASSERT(atoi(value) == i);
+		free(value);
+	}
+	CU_ASSERT(toml_get(snap, "key100") == NULL);
+	toml_free(snap);
+
+	unlink(path);
+	CU_ASSERT(toml_open_snapshot(path, &snap) == ENOENT);
+}
+
+/* A document big enough to be split, with things that look like headers */
+static char*
+bigDocument(size_t* len)
+{
+	size_t	size = 4 * 1024 * 1024, off = 0;
+	char*	doc = malloc(size);
+	int		i;
+
+	CU_ASSERT_FATAL(doc != NULL);
+
+	off += sprintf(doc + off, "title = \"big\"\n");
+	for (i = 0; off + 512 < size; i++) {
+		switch (i % 4) {
+		case 0:
+			off += sprintf(doc + off, "[host.h%d]\nip = \"10.0.%d.%d\"\nport = %d\n",
+											i, i / 256 % 256, i % 256, i);
+			break;
+		case 1:
+			off += sprintf(doc + off, "[[service]]\nname = 's%d'\n"
+					"text = \"\"\"\n[fake]\n[[fake]]\n\"\"\"\n", i);
+			break;
+		case 2:
+			off += sprintf(doc + off, "[[a.b]]\nn = %d\nraw = '''\n[x.y]\n'''\n", i);
+			break;
+		case 3:
+			off += sprintf(doc + off, "[host.h%d.nested]\nm = [\n[ %d, 2 ],\n"
+											"[ \"#[z]\" ]\n]\n", i - 3, i);
+			break;
+		}
+	}
+
+	*len = off;
+	return doc;
+}
+
+static void
+testParallel(void)
+{
+	int						ret;
+	struct toml_node*		root;
+	struct toml_parse_opts	opts = { 0, 4 };
+	char*					doc;
+	char*					sequential;
+	char*					parallel;
+	size_t					len;
+
+	doc = bigDocument(&len);
+
+	toml_init(&root);
+	ret = toml_parse(root, doc, len);
+	CU_ASSERT_FATAL(ret == 0);
+	sequential = jsonOf(root);
+	toml_free(root);
+
+	toml_init(&root);
+	ret = toml_parse_with_opts(root, doc, len, &opts);
+	CU_ASSERT_FATAL(ret == 0);
+	parallel = jsonOf(root);
+	toml_free(root);
+
+	CU_ASSERT(strcmp(sequential, parallel) == 0);
+	free(parallel);
+
+	opts.flags = TOML_PARSE_BORROW;
+	toml_init_arena(&root);
+	ret = toml_parse_with_opts(root, doc, len, &opts);
+	CU_ASSERT_FATAL(ret == 0);
+	parallel = jsonOf(root);
+	toml_free(root);
+
+	CU_ASSERT(strcmp(sequential, parallel) == 0);
+	free(parallel);
+	free(sequential);
+
+	/* a table defined again in a far away segment is still a duplicate */
+	len += sprintf(doc + len, "[host.h0]\nip = \"10.1.0.0\"\n");
+	opts.flags = 0;
+	toml_init(&root);
+	ret = toml_parse_with_opts(root, doc, len, &opts);
+	CU_ASSERT(ret != 0);
+	toml_free(root);
+
+	free(doc);
+}
+
+/* A lazily parsed document reads the same once every table is looked into */
+static void
+testLazy(void)
+{
+	int						ret;
+	struct toml_node*		root;
+	struct toml_node*		node;
+	struct toml_parse_opts	opts = { .flags = TOML_PARSE_LAZY };
+	char*					doc;
+	char*					eager;
+	char*					lazy;
+	size_t					len;
+	char					bad[] = "[a]\nx = 1\nx = 2\n[b]\ny = 2\n";
+
+	doc = bigDocument(&len);
+
+	toml_init(&root);
+	ret = toml_parse(root, doc, len);
+	CU_ASSERT_FATAL(ret == 0);
+	eager = jsonOf(root);
+	toml_free(root);
+
+	toml_init(&root);
+	ret = toml_parse_with_opts(root, doc, len, &opts);
+	CU_ASSERT_FATAL(ret == 0);
+	node = toml_get(root, "host.h4.port");
+	CU_ASSERT_FATAL(node != NULL);
+	CU_ASSERT(node->value.integer == 4);
+	lazy = jsonOf(root);
+	toml_free(root);
+
+	CU_ASSERT(strcmp(eager, lazy) == 0);
+	free(eager);
+	free(lazy);
+
+	/* freed with nothing looked into */
+	toml_init_arena(&root);
+	ret = toml_parse_with_opts(root, doc, len, &opts);
+	CU_ASSERT(ret == 0);
+	toml_free(root);
+
+	free(doc);
+
+	/* a bad body only shows when its table is read */
+	toml_init(&root);
+	ret = toml_parse_with_opts(root, bad, strlen(bad), &opts);
+	CU_ASSERT(ret == 0);
+	CU_ASSERT(toml_get(root, "b.y") != NULL);
+	CU_ASSERT(!toml_lazy_failed(root));
+	CU_ASSERT(toml_get(root, "a.x") == NULL);
+	CU_ASSERT(toml_lazy_failed(root));
+	/* and stays bad, the x read before the error is not let out */
+	CU_ASSERT(toml_get(root, "a.x") == NULL);
+	toml_free(root);
+
+	/* but a bad header shows at once */
+	strcpy(bad, "[a]\nx = 1\n[a]\n");
+	toml_init(&root);
+	ret = toml_parse_with_opts(root, bad, strlen(bad), &opts);
+	CU_ASSERT(ret != 0);
+	toml_free(root);
+}
+
+static void
+testReparse(void)
+{
+	int						ret;
+	struct toml_node*		root;
+	struct toml_node*		fresh;
+	struct toml_node*		port;
+	struct toml_node*		node;
+	char*					json;
+	char*					reparsed;
+	const char*				str;
+	size_t					len;
+	struct toml_parse_opts	opts = { .flags = TOML_PARSE_BORROW };
+	char					doc[] =
+		"title = \"a\"\n"
+		"[server]\nport = 80\n"
+		"[client]\nretries = 3\n";
+	char					edited[] =
+		"title = \"a\"\n"
+		"[server]\nport = 80\n"
+		"[client]\nretries = 5\n";
+	char					renamed[] =
+		"title = \"b\"\n"
+		"[server]\nport = 80\n"
+		"[client]\nretries = 3\n";
+	char					added[] =
+		"title = \"a\"\n"
+		"[server]\nport = 80\n"
+		"[proxy]\nport = 8080\n";
+
+	toml_init(&root);
+	ret = toml_reparse(root, doc, strlen(doc));
+	CU_ASSERT_FATAL(ret == 0);
+	port = toml_get(root, "server.port");
+	CU_ASSERT_FATAL(port != NULL);
+
+	/* only [client] changed, what points into [server] stays good */
+	ret = toml_reparse(root, edited, strlen(edited));
+	CU_ASSERT_FATAL(ret == 0);
+	CU_ASSERT(toml_get(root, "server.port") == port);
+	node = toml_get(root, "client.retries");
+	CU_ASSERT_FATAL(node != NULL);
+	CU_ASSERT(node->value.integer == 5);
+
+	toml_init(&fresh);
+	ret = toml_parse(fresh, edited, strlen(edited));
+	CU_ASSERT_FATAL(ret == 0);
+	json = jsonOf(fresh);
+	toml_free(fresh);
+	reparsed = jsonOf(root);
+	CU_ASSERT(strcmp(json, reparsed) == 0);
+	free(json);
+	free(reparsed);
+
+	/* new headers mean parsing it all again */
+	ret = toml_reparse(root, added, strlen(added));
+	CU_ASSERT_FATAL(ret == 0);
+	CU_ASSERT(toml_get(root, "client") == NULL);
+	node = toml_get(root, "proxy.port");
+	CU_ASSERT_FATAL(node != NULL);
+	CU_ASSERT(node->value.integer == 8080);
+
+	toml_free(root);
+
+	/* a borrowing document borrows what it reparses too */
+	toml_init(&root);
+	ret = toml_parse_with_opts(root, doc, strlen(doc), &opts);
+	CU_ASSERT_FATAL(ret == 0);
+	ret = toml_reparse(root, renamed, strlen(renamed));
+	CU_ASSERT_FATAL(ret == 0);
+	str = toml_get_string(toml_get(root, "title"), &len);
+	CU_ASSERT_FATAL(str != NULL);
+	CU_ASSERT(len == 1 && str == renamed + 9);
+
+	toml_free(root);
+}
+
+static void
+testHandle(void)
+{
+	int						ret;
+	unsigned int			ticket;
+	struct toml_node*		root;
+	struct toml_node*		node;
+	struct toml_handle*		handle;
+	char					v1[] = "[server]\nport = 80\n";
+	char					v2[] = "[server]\nport = 8080\n";
+	char					bad[] = "[server]\nport = \n";
+
+	toml_init(&root);
+	ret = toml_parse(root, v1, strlen(v1));
+	CU_ASSERT_FATAL(ret == 0);
+	handle = toml_handle_new(root);
+	CU_ASSERT_FATAL(handle != NULL);
+
+	root = toml_handle_acquire(handle, &ticket);
+	node = toml_get(root, "server.port");
+	CU_ASSERT_FATAL(node != NULL);
+	CU_ASSERT(node->value.integer == 80);
+	toml_handle_release(handle, ticket);
+
+	ret = toml_handle_reload(handle, v2, strlen(v2), NULL);
+	CU_ASSERT(ret == 0);
+
+	/* what does not parse is not published */
+	ret = toml_handle_reload(handle, bad, strlen(bad), NULL);
+	CU_ASSERT(ret != 0);
+
+	root = toml_handle_acquire(handle, &ticket);
+	node = toml_get(root, "server.port");
+	CU_ASSERT_FATAL(node != NULL);
+	CU_ASSERT(node->value.integer == 8080);
+	toml_handle_release(handle, ticket);
+
+	toml_handle_free(handle);
+}
+
+static int
+parseLimited(char* buf, const struct toml_limits* limits)
+{
+	struct toml_parse_opts	opts = { 0 };
+	struct toml_node*		root;
+	int						ret;
+
+	opts.limits = *limits;
+
+	toml_init(&root);
+	ret = toml_parse_with_opts(root, buf, strlen(buf), &opts);
+	toml_free(root);
+
+	return ret;
+}
+
+static void
+testLimits(void)
+{
+	struct toml_parse_opts	opts = { 0 };
+	struct toml_limits	limits = { 0 };
+	struct toml_node*	root;
+	struct toml_node*	table;
+	struct toml_node*	child;
+	char				nested[] = "a = [[[[1]]]]\n";
+	char				keys[] = "[t]\na = 1\nb = 2\nc = 3\n";
+	char				edited[] = "[t]\na = 1\nb = 5\nc = 3\n";
+	char				headers[] = "[t.a]\n[t.b]\n[t.c]\n";
+	char				string[] = "s = \"0123\\u00e9\"\n";
+	char				grown[] = "[t]\na = 1\nb = 2\nc = 3\nd = 4\ne = 5\nf = 6\n"
+									"g = 7\nh = 8\ni = 9\nj = 10\nk = 11\nl = 12\n"
+									"m = 13\nn = 14\no = 15\np = 16\n";
+	int					i, ret;
+
+	limits.max_depth = 3;
+	CU_ASSERT(parseLimited(nested, &limits) != 0);
+	limits.max_depth = 4;
+	CU_ASSERT(parseLimited(nested, &limits) == 0);
+
+	limits.max_keys = 2;
+	CU_ASSERT(parseLimited(keys, &limits) != 0);
+	limits.max_keys = 3;
+	CU_ASSERT(parseLimited(keys, &limits) == 0);
+
+	/* tables made by headers are keys of the table they are in */
+	limits.max_keys = 2;
+	CU_ASSERT(parseLimited(headers, &limits) != 0);
+	limits.max_keys = 3;
+	CU_ASSERT(parseLimited(headers, &limits) == 0);
+
+	/* the header's table and its three keys */
+	limits.max_nodes = 3;
+	CU_ASSERT(parseLimited(keys, &limits) != 0);
+	limits.max_nodes = 4;
+	CU_ASSERT(parseLimited(keys, &limits) == 0);
+
+	/* counted once unescaped */
+	limits.max_string = 5;
+	CU_ASSERT(parseLimited(string, &limits) != 0);
+	limits.max_string = 6;
+	CU_ASSERT(parseLimited(string, &limits) == 0);
+
+	limits.max_memory = 64;
+	CU_ASSERT(parseLimited(keys, &limits) != 0);
+	limits.max_memory = 64 * 1024;
+	CU_ASSERT(parseLimited(keys, &limits) == 0);
+
+	/* what a reparse takes out no longer counts */
+	opts.limits = limits;
+	toml_init(&root);
+	CU_ASSERT(toml_parse_with_opts(root, keys, strlen(keys), &opts) == 0);
+	for (i = 0; i < 8; i++) {
+		CU_ASSERT(toml_reparse(root, i & 1 ? keys : edited,
+											strlen(keys)) == 0);
+	}
+	toml_free(root);
+
+	/*
+	 * Wherever memory runs out, while the index of t grows among them, what
+	 * is in t so far stays whole.
+	 */
+	memset(&opts, 0, sizeof(opts));
+	for (opts.limits.max_memory = 8; ; opts.limits.max_memory += 8) {
+		toml_init(&root);
+		ret = toml_parse_with_opts(root, grown, strlen(grown), &opts);
+
+		i = 0;
+		table = toml_get(root, "t");
+		for (child = table ? toml_first_child(table) : NULL; child;
+										child = toml_next_child(table, child))
+			i++;
+		toml_free(root);
+
+		if (!ret)
+			break;
+		CU_ASSERT(i < 16);
+	}
+	CU_ASSERT(i == 16);
+}
+
+int main(void)
+{
+	CU_pSuite pSuite = NULL;
+
+	if (CUE_SUCCESS != CU_initialize_registry())
+		return CU_get_error();
+
+	pSuite = CU_add_suite("toml suite", init_toml, fini_toml);
+	if (NULL == pSuite)
+		goto out;
+
+	if ((NULL == CU_add_test(pSuite, "test fruit", testFruit)))
+		goto out;
+
+	if ((NULL == CU_add_test(pSuite, "test types", testTypes)))
+		goto out;
+
+	if ((NULL == CU_add_test(pSuite, "test numbers", testNumbers)))
+		goto out;
+
+	if ((NULL == CU_add_test(pSuite, "test good examples", testGoodExamples)))
+		goto out;
+
+	if ((NULL == CU_add_test(pSuite, "test bad examples", testBadExamples)))
+		goto out;
+
+	if ((NULL == CU_add_test(pSuite, "test UTF16", testUTF16)))
+		goto out;
+
+	if ((NULL == CU_add_test(pSuite, "test surrogate pairs", testSurrogates)))
+		goto out;
+
+	if ((NULL == CU_add_test(pSuite, "test UTF-8 validation", testUTF8Validation)))
+		goto out;
+
+	if ((NULL == CU_add_test(pSuite, "test UTF32", testUTF32)))
+		goto out;
+
+	if ((NULL == CU_add_test(pSuite, "test literal string", testLiteralString)))
+		goto out;
+
+	if ((NULL == CU_add_test(pSuite, "test literal multi-line string", testLiteralMultiLineString)))
+		goto out;
+
+	if ((NULL == CU_add_test(pSuite, "test basic multi-line string", testMultiLine)))
+		goto out;
+
+	if ((NULL == CU_add_test(pSuite, "test RFC3339 dates", testRFC3339)))
+		goto out;
+
+	if ((NULL == CU_add_test(pSuite, "test date arithmetic", testDates)))
+		goto out;
+
+	if ((NULL == CU_add_test(pSuite, "test inline table", testInlineTable)))
+		goto out;
+
+	if ((NULL == CU_add_test(pSuite, "test junk inputs", testJunkInputs)))
+		goto out;
+
+	if ((NULL == CU_add_test(pSuite, "test arena", testArena)))
+		goto out;
+
+	if ((NULL == CU_add_test(pSuite, "test wide table", testWideTable)))
+		goto out;
+
+	if ((NULL == CU_add_test(pSuite, "test borrowed input", testBorrowed)))
+		goto out;
+
+	if ((NULL == CU_add_test(pSuite, "test chunked input", testChunked)))
+		goto out;
+
+	if ((NULL == CU_add_test(pSuite, "test events", testEvents)))
+		goto out;
+
+	if ((NULL == CU_add_test(pSuite, "test binding", testBind)))
+		goto out;
+
+	if ((NULL == CU_add_test(pSuite, "test compiled paths", testCompiledPath)))
+		goto out;
+
+	if ((NULL == CU_add_test(pSuite, "test parallel parse", testParallel)))
+		goto out;
+
+	if ((NULL == CU_add_test(pSuite, "test lazy parsing", testLazy)))
+		goto out;
+
+	if ((NULL == CU_add_test(pSuite, "test incremental reparse", testReparse)))
+		goto out;
+
+	if ((NULL == CU_add_test(pSuite, "test document handles", testHandle)))
+		goto out;
+
+	if ((NULL == CU_add_test(pSuite, "test parse limits", testLimits)))
+		goto out;
+
+	if ((NULL == CU_add_test(pSuite, "test long strings", testLongStrings)))
+		goto out;
+
+	if ((NULL == CU_add_test(pSuite, "test huge strings", testHugeStrings)))
+		goto out;
+
+	if ((NULL == CU_add_test(pSuite, "test writers", testWriter)))
+		goto out;
+
+	if ((NULL == CU_add_test(pSuite, "test snapshots", testSnapshot)))
+		goto out;
+
+	if ((NULL == CU_add_test(pSuite, "test flattened documents", testFlatten)))
+		goto out;
+
+	if ((NULL == CU_add_test(pSuite, "test typed accessors", testAccessors)))
+		goto out;
+
+	if ((NULL == CU_add_test(pSuite, "test batch lookup", testGetMany)))
+		goto out;
+
+	if ((NULL == CU_add_test(pSuite, "test number values", testNumberValues)))
 		goto out;
 
 	CU_basic_set_mode(CU_BRM_VERBOSE);
@@ -11,142 +11,193 @@
 #include <errno.h>
 #include <string.h>
 
+static int
+_toml_init(struct toml_node **toml_root, struct toml_arena *arena)
+{
+	struct toml_document *doc;
+
+	doc = malloc(sizeof(*doc));
+	if (!doc) {
+		return -1;
+	}
+
+	doc->arena = arena;
+	doc->borrowed = NULL;
+	doc->parser = NULL;
+	doc->lazy = NULL;
+	doc->lazy_failed = false;
+	doc->outline = NULL;
+	doc->flags = 0;
+	memset(&doc->limits, 0, sizeof(doc->limits));
+	doc->nodes = 0;
+	doc->allocated = 0;
+	doc->limit = NULL;
+	doc->root.type = TOML_ROOT;
+	doc->root.name = NULL;
+	doc->root.name_len = 0;
+	doc->root.index = NULL;
+	list_head_init(&doc->root.value.map);
+
+	*toml_root = &doc->root;
+	return 0;
+}
+
 int
 toml_init(struct toml_node **toml_root)
 {
-	struct toml_node *toml_node;
+	return _toml_init(toml_root, NULL);
+}
+
+int
+toml_init_arena(struct toml_node **toml_root)
+{
+	struct toml_arena *arena;
 
-	toml_node = malloc(sizeof(*toml_node));
-	if (!toml_node) {
+	arena = toml_arena_new();
+	if (!arena)
 		return -1;
-	}
 
-	toml_node->type = TOML_ROOT;
-	toml_node->name = NULL;
-	list_head_init(&toml_node->value.map);
+	if (_toml_init(toml_root, arena)) {
+		toml_arena_destroy(arena);
+		return -1;
+	}
 
-	*toml_root = toml_node;
 	return 0;
 }
 
 struct toml_node *
 toml_get(struct toml_node *toml_root, char *key)
 {
-	char *ancestor, *tofree, *name;
 	struct toml_node *node = toml_root;
+	const char *path = key, *name;
+	size_t len;
 
-	tofree = name = strdup(key);
-
-	while ((ancestor = strsep(&name, "."))) {
-		struct toml_table_item *item = NULL;
-		int found = 0;
-
-		list_for_each(&node->value.map, item, map) {
-			if (!item->node.name)
-				continue;
-							
-			if (strcmp(item->node.name, ancestor) == 0) {
-				node = &item->node;
-				found = 1;
-				break;
-			}
-		}
-
-		if (!found) {
-			node = NULL;
-			break;
-		}
-	}
+	do {
+		path = toml_path_segment(path, &name, &len);
+		if (!path)
+			return NULL;
 
-	free(tofree);
+		node = toml_table_lookup(NULL, node, name, len);
+	} while (node && *path++);
 
 	return node;
 }
 
+/* Tabs for indenting, written in runs rather than one at a time */
 static void
-_toml_dump(struct toml_node *toml_node, FILE *output, char *bname, int indent,
-																	int newline)
+_write_indent(struct toml_writer* w, int indent)
 {
-	int		i;
-	char*	value;
+	static const char tabs[] = "\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t";
 
-	for (i = 0; i < indent - 1; i++)
-		fprintf(output, "\t");
+	for (; indent > 16; indent -= 16)
+		toml_write(w, tabs, 16);
+	if (indent > 0)
+		toml_write(w, tabs, indent);
+}
 
-	switch (toml_node->type) {
-	case TOML_ROOT: {
-		struct toml_table_item *item = NULL;
+/* Extend the dotted table path by name, returning where to cut it back to */
+static size_t
+_path_push(struct toml_writer* path, struct toml_node* node)
+{
+	size_t mark = path->len;
 
-		list_for_each(&toml_node->value.map, item, map) {
-			_toml_dump(&item->node, output, toml_node->name, indent, 1);
-		}
+	if (path->len)
+		toml_write_str(path, ".");
+	toml_write(path, node->name, node->name_len);
+
+	return mark;
+}
+
+static void
+_toml_dump(struct toml_node *toml_node, struct toml_writer *w,
+				struct toml_writer *path, int indent, int newline)
+{
+	struct toml_node view, *node = toml_view(toml_node, &view);
+	struct toml_node *child, *next;
+
+	_write_indent(w, indent - 1);
+
+	switch (node->type) {
+	case TOML_ROOT:
+		for (child = toml_first_child(toml_node); child;
+								child = toml_next_child(toml_node, child))
+			_toml_dump(child, w, path, indent, 1);
 		break;
-	}
 
 	case TOML_INLINE_TABLE:
 	case TOML_TABLE: {
-		struct toml_table_item *item = NULL;
-		char name[100];
-
-		if (toml_node->name) {
-			sprintf(name, "%s%s%s", bname ? bname : "", bname ? "." : "",
-															toml_node->name);
-			fprintf(output, "%s[%s]\n", indent ? "\t": "", name);
+		size_t mark = path->len;
+
+		if (node->name) {
+			mark = _path_push(path, node);
+			if (indent)
+				toml_write_str(w, "\t");
+			toml_write_str(w, "[");
+			toml_write(w, path->buf, path->len);
+			toml_write_str(w, "]\n");
 		}
-		list_for_each(&toml_node->value.map, item, map)
-			_toml_dump(&item->node, output, name, indent+1, 1);
-		fprintf(output, "\n");
+		for (child = toml_first_child(toml_node); child;
+								child = toml_next_child(toml_node, child))
+			_toml_dump(child, w, path, indent+1, 1);
+		toml_write_str(w, "\n");
+		path->len = mark;
 		break;
 	}
 
-	case TOML_LIST: {
-		struct toml_list_item *item = NULL;
-		struct toml_list_item *tail =
-				list_tail(&toml_node->value.list, struct toml_list_item, list);
-
-		if (toml_node->name)
-			fprintf(output, "%s = ", toml_node->name);
-		fprintf(output, "[ ");
-		list_for_each(&toml_node->value.list, item, list) {
-			_toml_dump(&item->node, output, toml_node->name, 0, 0);
-			if (item != tail)
-				fprintf(output, ", ");
+	case TOML_LIST:
+		if (node->name) {
+			toml_write(w, node->name, node->name_len);
+			toml_write_str(w, " = ");
 		}
-		fprintf(output, " ]%s", newline ? "\n" : "");
+		toml_write_str(w, "[ ");
+		for (child = toml_first_child(toml_node); child; child = next) {
+			next = toml_next_child(toml_node, child);
+			_toml_dump(child, w, path, 0, 0);
+			if (next)
+				toml_write_str(w, ", ");
+		}
+		toml_write_str(w, " ]");
+		if (newline)
+			toml_write_str(w, "\n");
 
 		break;
-	}
 
 	case TOML_INT:
 	case TOML_FLOAT:
 	case TOML_STRING:
 	case TOML_DATE:
 	case TOML_BOOLEAN:
-		if (toml_node->name)
-			fprintf(output, "%s = ", toml_node->name);
-		value = toml_value_as_string(toml_node);
-		fprintf(output, "%s%s%s%s",
-				toml_node->type == TOML_STRING ? "\"" : "",
-				value, 
-				toml_node->type == TOML_STRING ? "\"" : "",
-				newline ? "\n" : "");
-		free(value);
+		if (node->name) {
+			toml_write(w, node->name, node->name_len);
+			toml_write_str(w, " = ");
+		}
+		if (node->type == TOML_STRING)
+			toml_write_str(w, "\"");
+		toml_write_value(w, node);
+		if (node->type == TOML_STRING)
+			toml_write_str(w, "\"");
+		if (newline)
+			toml_write_str(w, "\n");
 		break;
 
 	case TOML_TABLE_ARRAY: {
-		struct toml_list_item *item = NULL;
-
-		list_for_each(&toml_node->value.list, item, list) {
-			fprintf(output, "[[%s]]\n", toml_node->name);
-			_toml_dump(&item->node, output, toml_node->name, indent, 1);
+		size_t mark = _path_push(path, node);
+
+		for (child = toml_first_child(toml_node); child;
+								child = toml_next_child(toml_node, child)) {
+			toml_write_str(w, "[[");
+			toml_write(w, path->buf, path->len);
+			toml_write_str(w, "]]\n");
+			_toml_dump(child, w, path, indent, 1);
 		}
+		path->len = mark;
 
 		break;
 	}
 
 	default:
-		fprintf(stderr, "unknown toml type %d\n", toml_node->type);
-		/* assert(toml_node->type); */
+		fprintf(stderr, "unknown toml type %d\n", node->type);
+		/* assert(node->type); */
 	}
 }
 
@@ -158,32 +209,14 @@ enum order {
 static void
 _toml_process(struct toml_node *node, toml_node_walker fn, enum order order, void *ctx)
 {
+	struct toml_node *child, *next;
+
 	if (order == kOrderWalk)
 		fn(node, ctx);
 
-	switch (node->type) {
-	case TOML_ROOT:
-	case TOML_INLINE_TABLE:
-	case TOML_TABLE: {
-		struct toml_table_item *item = NULL, *next = NULL;
-
-		list_for_each_safe(&node->value.map, item, next, map)
-			_toml_process(&item->node, fn, order, ctx);
-		break;
-	}
-
-	case TOML_TABLE_ARRAY:
-	case TOML_LIST: {
-		struct toml_list_item *item = NULL, *next = NULL;
-
-		list_for_each_safe(&node->value.list, item, next, list) {
-			_toml_process(&item->node, fn, order, ctx);
-		}
-		break;
-	}
-
-	default:
-		break;
+	for (child = toml_first_child(node); child; child = next) {
+		next = toml_next_child(node, child);
+		_toml_process(child, fn, order, ctx);
 	}
 
 	if (order == kOrderDive)
@@ -193,6 +226,11 @@ _toml_process(struct toml_node *node, toml_node_walker fn, enum order order, voi
 void
 toml_walk(struct toml_node *root, toml_node_walker fn, void *ctx)
 {
+	if (toml_is_flat(root)) {
+		toml_flat_walk(root, fn, ctx);
+		return;
+	}
+
 	_toml_process(root, fn, kOrderWalk, ctx);
 }
 
@@ -202,224 +240,169 @@ toml_dive(struct toml_node *root, toml_node_walker fn, void *ctx)
 	_toml_process(root, fn, kOrderDive, ctx);
 }
 
-void
-toml_dump(struct toml_node *toml_root, FILE *output)
+static int
+_write_file(void* ctx, const char* buf, size_t len)
 {
-	_toml_dump(toml_root, output, NULL, 0, 1);
+	return fwrite(buf, 1, len, ctx) == len ? 0 : EIO;
 }
 
-static char*
-_json_string_encode(const char* string)
-{
-	char*	ret;
-	int		j = 0;
-	int		i = 0;
-
-	for (i = 0; string[i]; i++)
-	{
-		switch (string[i]) {
-		case '"':
-		case '\\':
-		case '/':
-		case '\b':
-		case '\f':
-		case '\n':
-		case '\r':
-		case '\t':
-			j++;
-
-		default:
-			break;
-		}
-	}
+int
+toml_dump_to(struct toml_node *toml_root, struct toml_writer *w)
+{
+	struct toml_writer path;
+	int ret;
 
-	ret = malloc(i + j + 1);
-	for (i = 0, j = 0; string[i]; i++)
-	{
-		switch (string[i]) {
-		case '"':
-			ret[i+j++] = '\\';
-			ret[i+j] = '"';
-			break;
-
-		case '\\':
-			ret[i+j++] = '\\';
-			ret[i+j] = '\\';
-			break;
-
-		case '/':
-			ret[i+j++] = '\\';
-			ret[i+j] = '/';
-			break;
-
-		case '\b':
-			ret[i+j++] = '\\';
-			ret[i+j] = 'b';
-			break;
-
-		case '\f':
-			ret[i+j++] = '\\';
-			ret[i+j] = 'f';
-			break;
-
-		case '\n':
-			ret[i+j++] = '\\';
-			ret[i+j] = 'n';
-			break;
-
-		case '\r':
-			ret[i+j++] = '\\';
-			ret[i+j] = 'r';
-			break;
-
-		case '\t':
-			ret[i+j++] = '\\';
-			ret[i+j] = 't';
-			break;
-
-		default:
-			ret[i+j] = string[i];
-			break;
-		}
-	}
+	toml_writer_init(&path, TOML_WRITER_BUFFER, NULL, 0);
+	_toml_dump(toml_root, w, &path, 0, 1);
+	free(path.buf);
+
+	ret = toml_writer_flush(w);
+	return ret ? ret : path.error;
+}
 
-	ret[i+j] = 0;
+void
+toml_dump(struct toml_node *toml_root, FILE *output)
+{
+	struct toml_writer w;
+	char buf[BUFSIZ];
 
-	return ret;
+	toml_writer_init(&w, TOML_WRITER_CALLBACK, buf, sizeof(buf));
+	w.fn = _write_file;
+	w.ctx = output;
+	toml_dump_to(toml_root, &w);
 }
 
+static const char* const toml_json_types[TOML_MAX] = {
+	[TOML_INT]		= "integer",
+	[TOML_FLOAT]	= "float",
+	[TOML_STRING]	= "string",
+	[TOML_DATE]		= "datetime",
+	[TOML_BOOLEAN]	= "bool",
+};
+
 static void
-_output_name(struct toml_node* node, FILE* output)
+_end_item(struct toml_writer* w, bool last)
 {
-	char* name;
+	toml_write_str(w, last ? "\n" : ",\n");
+}
 
+static void
+_output_name(struct toml_node* node, struct toml_writer* w)
+{
 	if (!node->name)
 		return;
 
-	name = _json_string_encode(node->name);
-	fprintf(output, "\"%s\": ", name);
-	free(name);
+	toml_write_str(w, "\"");
+	toml_write_escaped(w, node->name, node->name_len);
+	toml_write_str(w, "\": ");
 }
 
+static void _toml_tojson(struct toml_node *, struct toml_writer *, int);
+
+/* The children of node, one to a line */
 static void
-_toml_tojson(struct toml_node *toml_node, FILE *output, int indent)
+_toml_tojson_children(struct toml_node *toml_node, struct toml_writer *w,
+																int indent)
 {
-	int		i;
-	char*	value;
+	struct toml_node *child, *next;
 
-	char*	toml_json_types[TOML_MAX];
-
-	toml_json_types[TOML_INT]		= "integer";
-	toml_json_types[TOML_FLOAT]		= "float";
-	toml_json_types[TOML_STRING]	= "string";
-	toml_json_types[TOML_DATE]		= "datetime";
-	toml_json_types[TOML_BOOLEAN]	= "bool";
+	for (child = toml_first_child(toml_node); child; child = next) {
+		next = toml_next_child(toml_node, child);
+		_toml_tojson(child, w, indent);
+		_end_item(w, !next);
+	}
+}
 
-	for (i = 0; i < indent - 1; i++)
-		fprintf(output, "\t");
+static void
+_toml_tojson(struct toml_node *toml_node, struct toml_writer *w, int indent)
+{
+	struct toml_node view, *node = toml_view(toml_node, &view);
 
-	switch (toml_node->type) {
-	case TOML_ROOT: {
-		struct toml_table_item *item = NULL;
-		struct toml_table_item *tail =
-			list_tail(&toml_node->value.map, struct toml_table_item, map);
+	_write_indent(w, indent - 1);
 
-		list_for_each(&toml_node->value.map, item, map) {
-			_toml_tojson(&item->node, output, indent+1);
-			fprintf(output, "%s\n", item != tail ? "," : "");
-		}
+	switch (node->type) {
+	case TOML_ROOT:
+		_toml_tojson_children(toml_node, w, indent+1);
 		break;
-	}
 
 	case TOML_INLINE_TABLE:
-	case TOML_TABLE: {
-		struct toml_table_item *item = NULL;
-		struct toml_table_item *tail =
-			list_tail(&toml_node->value.map, struct toml_table_item, map);
-
-		_output_name(toml_node, output);
-
-		fprintf(output, "{\n");
+	case TOML_TABLE:
+		_output_name(node, w);
 
-		list_for_each(&toml_node->value.map, item, map) {
-			_toml_tojson(&item->node, output, indent+1);
-			fprintf(output, "%s\n", item != tail ? "," : "");
-		}
+		toml_write_str(w, "{\n");
+		_toml_tojson_children(toml_node, w, indent+1);
 
-		for (i = 0; i < indent - 1; i++)
-			fprintf(output, "\t");
-		fprintf(output, "}");
+		_write_indent(w, indent - 1);
+		toml_write_str(w, "}");
 		break;
-	}
-
-	case TOML_LIST: {
-		struct toml_list_item *item = NULL;
-		struct toml_list_item *tail =
-			list_tail(&toml_node->value.map, struct toml_list_item, list);
 
-		_output_name(toml_node, output);
-		fprintf(output, "{ \"type\": \"array\", \"value\": [\n");
+	case TOML_LIST:
+		_output_name(node, w);
+		toml_write_str(w, "{ \"type\": \"array\", \"value\": [\n");
 
-		list_for_each(&toml_node->value.list, item, list) {
-			_toml_tojson(&item->node, output, indent+1);
-			fprintf(output, "%s\n", item != tail ? "," : "");
-		}
+		_toml_tojson_children(toml_node, w, indent+1);
 
-		for (i = 0; i < indent - 1; i++)
-			fprintf(output, "\t");
-		fprintf(output, " ] }");
+		_write_indent(w, indent - 1);
+		toml_write_str(w, " ] }");
 		break;
-	}
 
 	case TOML_INT:
 	case TOML_FLOAT:
 	case TOML_STRING:
 	case TOML_DATE:
 	case TOML_BOOLEAN:
-		value = toml_value_as_string(toml_node);
-		_output_name(toml_node, output);
-		fprintf(output, "{ \"type\": \"%s\", \"value\": \"%s\" }",
-									toml_json_types[toml_node->type], value);
-		free(value);
+		_output_name(node, w);
+		toml_write_str(w, "{ \"type\": \"");
+		toml_write_str(w, toml_json_types[node->type]);
+		toml_write_str(w, "\", \"value\": \"");
+		toml_write_value(w, node);
+		toml_write_str(w, "\" }");
 		break;
 
-	case TOML_TABLE_ARRAY: {
-		struct toml_list_item *item = NULL;
-		struct toml_list_item *tail =
-			list_tail(&toml_node->value.list, struct toml_list_item, list);
-
-		_output_name(toml_node, output);
-		fprintf(output, "[\n");
+	case TOML_TABLE_ARRAY:
+		_output_name(node, w);
+		toml_write_str(w, "[\n");
 
-		list_for_each(&toml_node->value.list, item, list) {
-			_toml_tojson(&item->node, output, indent+1);
-			fprintf(output, "%s\n", item != tail ? "," : "");
-		}
+		_toml_tojson_children(toml_node, w, indent+1);
 
-		for (i = 0; i < indent - 1; i++)
-			fprintf(output, "\t");
-		fprintf(output, "]");
+		_write_indent(w, indent - 1);
+		toml_write_str(w, "]");
 		break;
-	}
 
 	default:
-		fprintf(stderr, "unknown toml type %d\n", toml_node->type);
-		/* assert(toml_node->type); */
+		fprintf(stderr, "unknown toml type %d\n", node->type);
+		/* assert(node->type); */
 	}
 }
 
+int
+toml_tojson_to(struct toml_node *toml_root, struct toml_writer *w)
+{
+	toml_write_str(w, "{\n");
+	_toml_tojson(toml_root, w, 1);
+	toml_write_str(w, "}\n");
+
+	return toml_writer_flush(w);
+}
+
 void
 toml_tojson(struct toml_node *toml_root, FILE *output)
 {
-	fprintf(output, "{\n");
-	_toml_tojson(toml_root, output, 1);
-	fprintf(output, "}\n");
+	struct toml_writer w;
+	char buf[BUFSIZ];
+
+	toml_writer_init(&w, TOML_WRITER_CALLBACK, buf, sizeof(buf));
+	w.fn = _write_file;
+	w.ctx = output;
+	toml_tojson_to(toml_root, &w);
 }
 
 static void
 toml_node_walker_free(struct toml_node* node, void* ctx)
 {
-	if (node->name)
+	struct toml_document* doc = ctx;
+
+	if (node->name && !toml_is_borrowed(doc, node->name))
 		free(node->name);
 
 	switch (node->type) {
@@ -428,6 +411,8 @@ toml_node_walker_free(struct toml_node* node, void* ctx)
 	case TOML_TABLE: {
 		struct toml_table_item *item = NULL, *next = NULL;
 
+		free(node->index);
+
 		list_for_each_safe(&node->value.map, item, next, map) {
 			list_del(&item->map);
 			free(item);
@@ -447,7 +432,8 @@ toml_node_walker_free(struct toml_node* node, void* ctx)
 	}
 
 	case TOML_STRING:
-		free(node->value.string);
+		if (!toml_is_borrowed(doc, node->value.string))
+			free(node->value.string);
 		break;
 
 	default:
@@ -458,75 +444,251 @@ toml_node_walker_free(struct toml_node* node, void* ctx)
 void
 toml_free(struct toml_node *toml_root)
 {
+	struct toml_document *doc;
+
+	if (toml_is_flat(toml_root)) {
+		toml_flat_free(toml_root);
+		return;
+	}
+
 	assert(toml_root->type == TOML_ROOT);
-	toml_dive(toml_root, toml_node_walker_free, NULL);
-	free(toml_root);
+	doc = toml_document(toml_root);
+
+	/* a parse that was never finished */
+	if (doc->parser)
+		toml_parser_free(doc->parser);
+
+	/* tables never looked into are freed as they are, not read first */
+	toml_lazy_free(doc);
+	free(doc->outline);
+
+	/* arena documents release their chunks without visiting a single node */
+	if (doc->arena) {
+		toml_arena_destroy(doc->arena);
+	} else {
+		struct toml_borrowed *borrowed, *next;
+
+		toml_dive(toml_root, toml_node_walker_free, doc);
+
+		for (borrowed = doc->borrowed; borrowed; borrowed = next) {
+			next = borrowed->next;
+			free(borrowed);
+		}
+	}
+
+	free(doc);
 }
 
-char*
-toml_value_as_string(struct toml_node* node)
+/* Give back to the limits of doc what node counted against them */
+static void
+toml_node_walker_uncount(struct toml_node* node, void* ctx)
 {
-	char* ret = NULL;
+	struct toml_document*	doc = ctx;
+	size_t					size = sizeof(struct toml_table_item);
 
-	switch (node->type)
-	{
-	case TOML_INT:
-		asprintf(&ret, "%" PRId64, node->value.integer);
-		break;
+	if (node->name && !toml_is_borrowed(doc, node->name))
+		size += node->name_len + 1;
 
-	case TOML_FLOAT:
-		asprintf(&ret, "%.*f", node->value.floating.precision,
-								node->value.floating.value);
+	switch (node->type) {
+	case TOML_INLINE_TABLE:
+	case TOML_TABLE:
+		if (node->index && !toml_is_lazy(node))
+			size += toml_index_size(node->index);
 		break;
 
 	case TOML_STRING:
-		ret = _json_string_encode(node->value.string);
+		if (!toml_is_borrowed(doc, node->value.string))
+			size += node->value.string_len + 1;
 		break;
 
-	case TOML_DATE: {
-		struct tm	tm;
-		char		offset_string[7] = "Z";
-		char		sec_frac[1024] = "";
+	default:
+		break;
+	}
 
-		if (!node->value.rfc3339_time.offset_is_zulu)
-			sprintf(offset_string, "%s%02d:%02d",
-				node->value.rfc3339_time.offset_sign_negative ? "-" : "+",
-				node->value.rfc3339_time.offset / 60,
-				node->value.rfc3339_time.offset % 60);
+	toml_uncharge(doc, size);
+	toml_uncount_node(doc);
+}
 
-		if (node->value.rfc3339_time.sec_frac != -1)
-			snprintf(sec_frac, sizeof(sec_frac), ".%d",
-											node->value.rfc3339_time.sec_frac);
+/*
+ * Take the children out of table, with keys_only all but the tables and table
+ * arrays made by headers.  Arena documents keep their memory until freed.
+ */
+void
+toml_table_clear(struct toml_document *doc, struct toml_node *table, bool keys_only)
+{
+	struct toml_table_item *item, *next;
 
-		if (!gmtime_r(&node->value.rfc3339_time.epoch, &tm))
-			break;
+	list_for_each_safe(&table->value.map, item, next, map) {
+		if (keys_only && (item->node.type == TOML_TABLE ||
+								item->node.type == TOML_TABLE_ARRAY))
+			continue;
 
-		asprintf(&ret, "%d-%02d-%02dT%02d:%02d:%02d%s%s",
-			1900 + tm.tm_year,
-			tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec,
-			sec_frac, offset_string);
-		break;
+		list_del(&item->map);
+		toml_dive(&item->node, toml_node_walker_uncount, doc);
+		if (!doc->arena) {
+			toml_dive(&item->node, toml_node_walker_free, doc);
+			free(item);
+		}
 	}
 
+	/* built again by the next parse into the table */
+	toml_index_release(doc, table);
+}
+
+/* Whatever was written into a memory writer as a string of its own */
+static char*
+_detach_string(struct toml_writer* w)
+{
+	toml_write(w, "", 1);
+	if (w->error || !w->len) {
+		free(w->buf);
+		return NULL;
+	}
+
+	return w->buf;
+}
+
+char*
+toml_value_as_string(struct toml_node* node)
+{
+	struct toml_writer w;
+	struct toml_node view;
+
+	node = toml_view(node, &view);
+
+	switch (node->type) {
+	case TOML_INT:
+	case TOML_FLOAT:
+	case TOML_STRING:
+	case TOML_DATE:
 	case TOML_BOOLEAN:
-		asprintf(&ret, "%s", node->value.integer ? "true" : "false");
 		break;
 
 	default:
-		break;
+		return NULL;
 	}
 
-	return ret;
+	toml_writer_init(&w, TOML_WRITER_BUFFER, NULL, 0);
+	toml_write_value(&w, node);
+
+	return _detach_string(&w);
+}
+
+bool
+toml_get_int64(struct toml_node* node, int64_t* value)
+{
+	struct toml_node view;
+
+	if (!node)
+		return false;
+	node = toml_view(node, &view);
+	if (node->type != TOML_INT)
+		return false;
+
+	*value = node->value.integer;
+	return true;
+}
+
+bool
+toml_get_double(struct toml_node* node, double* value)
+{
+	struct toml_node view;
+
+	if (!node)
+		return false;
+	node = toml_view(node, &view);
+	if (node->type != TOML_FLOAT)
+		return false;
+
+	*value = node->value.floating.value;
+	return true;
+}
+
+bool
+toml_get_bool(struct toml_node* node, bool* value)
+{
+	struct toml_node view;
+
+	if (!node)
+		return false;
+	node = toml_view(node, &view);
+	if (node->type != TOML_BOOLEAN)
+		return false;
+
+	*value = node->value.integer != 0;
+	return true;
+}
+
+const char*
+toml_get_string(struct toml_node* node, size_t* len)
+{
+	struct toml_node view;
+
+	if (!node)
+		return NULL;
+	node = toml_view(node, &view);
+	if (node->type != TOML_STRING)
+		return NULL;
+
+	*len = node->value.string_len;
+	return node->value.string;
+}
+
+bool
+toml_get_datetime(struct toml_node* node, struct toml_datetime* date)
+{
+	struct toml_node view;
+	long nsec;
+	int digits;
+
+	if (!node)
+		return false;
+	node = toml_view(node, &view);
+	if (node->type != TOML_DATE)
+		return false;
+
+	nsec = node->value.rfc3339_time.sec_frac;
+	for (digits = node->value.rfc3339_time.sec_frac_digits; digits < 9; digits++)
+		nsec *= 10;
+
+	date->epoch = node->value.rfc3339_time.epoch;
+	date->nsec = nsec;
+	date->offset = node->value.rfc3339_time.offset;
+	date->zulu = node->value.rfc3339_time.offset_is_zulu;
+	return true;
+}
+
+const char*
+toml_name_view(struct toml_node* node, size_t* len)
+{
+	struct toml_node view;
+
+	if (!node)
+		return NULL;
+	node = toml_view(node, &view);
+	if (!node->name)
+		return NULL;
+
+	*len = node->name_len;
+	return node->name;
 }
 
 enum toml_type
 toml_type(struct toml_node* node)
 {
-	return node->type;
+	return node->type & ~TOML_FLAT;
 }
 
 char*
 toml_name(struct toml_node* node)
 {
-	return _json_string_encode(node->name);
+	struct toml_writer w;
+	struct toml_node view;
+
+	node = toml_view(node, &view);
+
+	toml_writer_init(&w, TOML_WRITER_BUFFER, NULL, 0);
+	toml_write_escaped(&w, node->name, node->name_len);
+
+	return _detach_string(&w);
 }
@@ -1,7 +1,10 @@
 #ifndef TOML_H
 #define TOML_H
 
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <time.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -22,20 +25,177 @@ enum toml_type {
 };
 
 struct toml_node;
+struct toml_path;
+struct toml_handle;
+
+enum toml_parse_flags {
+	/*
+	 * Names and strings may point into the input buffer rather than being
+	 * copied, the buffer must then outlive the document.  Such views are not
+	 * NUL terminated.
+	 */
+	TOML_PARSE_BORROW = 1 << 0,
+	/* The input is known to be UTF-8, skip checking it is */
+	TOML_PARSE_TRUSTED = 1 << 1,
+	/*
+	 * Only the table headers are read up front, each table's keys the first
+	 * time it is looked into.  The buffer must outlive the document, which
+	 * must not then be read from more than one thread at once.
+	 */
+	TOML_PARSE_LAZY = 1 << 2,
+};
+
+/*
+ * Bounds for input that cannot be trusted, each 0 for none.  A parse that
+ * would go past one fails.  Parsing takes time linear in the input whatever
+ * it holds, short of keys made to collide in a table's hash index, which
+ * max_keys bounds.
+ */
+struct toml_limits {
+	unsigned int	max_depth;		/* lists and inline tables within each other */
+	unsigned int	max_keys;		/* in any one table, header tables too */
+	size_t			max_string;		/* bytes in a string value */
+	size_t			max_nodes;
+	size_t			max_memory;		/* bytes allocated, the parser's too */
+};
+
+struct toml_parse_opts {
+	unsigned int		flags;		/* enum toml_parse_flags */
+	unsigned int		threads;	/* > 1 splits big documents between threads */
+	struct toml_limits	limits;		/* kept for what a lazy parse reads later */
+};
+
+/* Room for any date toml_format_date() writes, with its NUL */
+#define TOML_DATE_MAX	64
+
+/* A date as toml_get_datetime() gives it */
+struct toml_datetime {
+	time_t	epoch;			/* UTC */
+	long	nsec;
+	int		offset;			/* minutes ahead of UTC it was written in */
+	bool	zulu;			/* written with a Z rather than +00:00 */
+};
+
+/*
+ * How toml_bind() fills in a structure: each binding puts the value at path,
+ * taken from the table the structure stands for, size bytes in at offset.
+ * Integers may be 1, 2, 4 or 8 bytes, floats float or double and strings
+ * char arrays, which get a NUL.  A table is another structure described by
+ * fields, a table array an array of size bytes in all with elements stride
+ * bytes apart, counted in the size_t at count_offset.  Lists of bindings end
+ * with a NULL path.
+ */
+enum toml_bind_type {
+	TOML_BIND_INT = 1,
+	TOML_BIND_DOUBLE,
+	TOML_BIND_BOOL,
+	TOML_BIND_STRING,
+	TOML_BIND_DATE,				/* struct toml_datetime */
+	TOML_BIND_TABLE,
+	TOML_BIND_TABLE_ARRAY,
+};
+
+struct toml_binding {
+	const char*					path;
+	enum toml_bind_type			type;
+	size_t						offset;
+	size_t						size;
+	const struct toml_binding*	fields;			/* tables and table arrays */
+	size_t						stride;			/* table arrays */
+	size_t						count_offset;	/* table arrays */
+};
+
+enum toml_bind_flags {
+	TOML_BIND_STRICT = 1 << 0,	/* keys with no binding are an error */
+};
 
 typedef void (*toml_node_walker)(struct toml_node*, void*);
 
+/*
+ * Where toml_dump_to() and toml_tojson_to() send their output.  A callback
+ * returns 0 if all went well, anything else is kept as the writer's error.
+ */
+struct toml_writer;
+typedef int (*toml_write_fn)(void* ctx, const char* buf, size_t len);
+
+/*
+ * Handlers for toml_parse_events(), any of which may be NULL.  Each gets the
+ * ctx passed to toml_parse_events() and returns 0 to carry on, anything else
+ * stops the parse and becomes its return value.  Names and values point into
+ * the input or a scratch buffer, are not NUL terminated and only last for
+ * the duration of the call.  A value's text is its TOML spelling, except for
+ * strings which are passed unescaped.
+ */
+struct toml_events {
+	int (*begin_table)(void* ctx, const char* name, size_t len);
+	int (*begin_table_array)(void* ctx, const char* name, size_t len);
+	int (*key)(void* ctx, const char* name, size_t len);
+	int (*value)(void* ctx, enum toml_type type, const char* raw, size_t len);
+	int (*begin_array)(void* ctx);
+	int (*end_array)(void* ctx);
+	int (*begin_inline_table)(void* ctx);
+	int (*end_inline_table)(void* ctx);
+};
+
 int toml_init(struct toml_node**);
+int toml_init_arena(struct toml_node**);		/* toml_free releases the whole arena */
 int toml_parse(struct toml_node*, char*, int);
+int toml_parse_with_opts(struct toml_node*, char*, int, const struct toml_parse_opts*);
+int toml_parse_chunk(struct toml_node*, const char*, size_t);	/* input in pieces... */
+int toml_parse_finish(struct toml_node*);						/* ...then its end */
+bool toml_lazy_failed(struct toml_node*);	/* a table read later did not parse */
+int toml_reparse(struct toml_node*, char*, int);		/* the same document, edited */
+int toml_parse_events(char*, int, const struct toml_events*, void*);	/* no tree */
+int toml_bind(char*, int, const struct toml_binding*, void*, unsigned int);	/* no tree either */
 struct toml_node* toml_get(struct toml_node*, char*);
+int toml_get_many(struct toml_node*, const char**, size_t, struct toml_node**);	/* 0 or an errno */
+struct toml_path* toml_path_compile(const char*);	/* for toml_get_compiled */
+struct toml_node* toml_get_compiled(struct toml_node*, const struct toml_path*);
+void toml_path_free(struct toml_path*);
 void toml_dump(struct toml_node*, FILE*);
 void toml_tojson(struct toml_node*, FILE*);
+int toml_dump_to(struct toml_node*, struct toml_writer*);		/* 0 or an errno */
+int toml_tojson_to(struct toml_node*, struct toml_writer*);
+struct toml_writer* toml_writer_buffer(void);				/* output kept in memory */
+struct toml_writer* toml_writer_fd(int);
+struct toml_writer* toml_writer_callback(toml_write_fn, void*);
+const char* toml_writer_data(struct toml_writer*, size_t*);	/* of a buffer writer */
+int toml_writer_flush(struct toml_writer*);
+int toml_writer_free(struct toml_writer*);					/* flushes first */
 void toml_free(struct toml_node*);
+int toml_save_snapshot(struct toml_node*, const char*);		/* 0 or an errno */
+int toml_open_snapshot(const char*, struct toml_node**);	/* read only */
+int toml_flatten(struct toml_node*, struct toml_node**);	/* read only copy */
 void toml_walk(struct toml_node*, toml_node_walker, void*);
 void toml_dive(struct toml_node*, toml_node_walker, void*);
 enum toml_type toml_type(struct toml_node*);
 char* toml_name(struct toml_node*);				/* caller should free return value */
 char* toml_value_as_string(struct toml_node*);	/* caller should free return value */
+size_t toml_format_date(struct toml_node*, char*, size_t);	/* like snprintf */
+
+/*
+ * The value itself, no copies made.  Each is false (or NULL) if the node is
+ * NULL or not of that type.  Strings and names belong to the document and are
+ * not NUL terminated if it borrowed its input.
+ */
+bool toml_get_int64(struct toml_node*, int64_t*);
+bool toml_get_double(struct toml_node*, double*);
+bool toml_get_bool(struct toml_node*, bool*);
+const char* toml_get_string(struct toml_node*, size_t*);
+bool toml_get_datetime(struct toml_node*, struct toml_datetime*);
+const char* toml_name_view(struct toml_node*, size_t*);
+
+/*
+ * A document swapped for a newer one while other threads read it.  Readers
+ * hold the document from acquire to release without taking a lock, a reload
+ * waits for those still holding the old one before freeing it.
+ */
+struct toml_handle* toml_handle_new(struct toml_node*);	/* takes the document */
+struct toml_node* toml_handle_acquire(struct toml_handle*, unsigned int*);
+void toml_handle_release(struct toml_handle*, unsigned int);
+void toml_handle_swap(struct toml_handle*, struct toml_node*);
+int toml_handle_reload(struct toml_handle*, char*, int, const struct toml_parse_opts*);
+void toml_handle_free(struct toml_handle*);
 
 #ifdef __cplusplus
 }; // extern "C"
@@ -0,0 +1,267 @@
+#include "toml_private.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+/*
+ * A document created with toml_init_arena() takes every node, name and string
+ * from a short list of large chunks.  Nothing allocated from an arena is ever
+ * released on its own, toml_free() simply hands the chunks back.
+ */
+
+#define ARENA_ALIGN			sizeof(void*)
+#define ARENA_FIRST_CHUNK	(64 * 1024)
+#define ARENA_MAX_CHUNK		(8 * 1024 * 1024)
+
+struct toml_arena_chunk {
+	struct toml_arena_chunk*	next;
+	size_t						size;
+	size_t						used;
+	char						data[];
+};
+
+struct toml_arena {
+	struct toml_arena_chunk*	chunks;
+	size_t						next_size;
+};
+
+static struct toml_arena_chunk*
+arena_chunk_new(size_t size)
+{
+	struct toml_arena_chunk* chunk;
+
+	chunk = malloc(sizeof(*chunk) + size);
+	if (!chunk)
+		return NULL;
+
+	chunk->next = NULL;
+	chunk->size = size;
+	chunk->used = 0;
+
+	return chunk;
+}
+
+struct toml_arena*
+toml_arena_new(void)
+{
+	struct toml_arena* arena;
+
+	arena = malloc(sizeof(*arena));
+	if (!arena)
+		return NULL;
+
+	arena->chunks = NULL;
+	arena->next_size = ARENA_FIRST_CHUNK;
+
+	return arena;
+}
+
+void*
+toml_arena_alloc(struct toml_arena* arena, size_t size)
+{
+	struct toml_arena_chunk*	chunk = arena->chunks;
+	void*						ret;
+
+	size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+	if (chunk && chunk->size - chunk->used >= size) {
+		ret = chunk->data + chunk->used;
+		chunk->used += size;
+		return ret;
+	}
+
+	/*
+	 * Big requests get a chunk of their own which goes behind the current
+	 * one, so whatever space is left in the current chunk is not wasted.
+	 */
+	if (size > arena->next_size / 4) {
+		struct toml_arena_chunk* big = arena_chunk_new(size);
+		if (!big)
+			return NULL;
+
+		big->used = size;
+		if (chunk) {
+			big->next = chunk->next;
+			chunk->next = big;
+		} else {
+			arena->chunks = big;
+		}
+		return big->data;
+	}
+
+	chunk = arena_chunk_new(arena->next_size);
+	if (!chunk)
+		return NULL;
+
+	chunk->next = arena->chunks;
+	arena->chunks = chunk;
+	if (arena->next_size < ARENA_MAX_CHUNK)
+		arena->next_size *= 2;
+
+	chunk->used = size;
+	return chunk->data;
+}
+
+void
+toml_arena_destroy(struct toml_arena* arena)
+{
+	struct toml_arena_chunk *chunk, *next;
+
+	for (chunk = arena->chunks; chunk; chunk = next) {
+		next = chunk->next;
+		free(chunk);
+	}
+
+	free(arena);
+}
+
+/* Hand every chunk of src over to dst, leaving src empty */
+void
+toml_arena_adopt(struct toml_arena* dst, struct toml_arena* src)
+{
+	struct toml_arena_chunk* last;
+
+	if (!src->chunks)
+		return;
+
+	if (!dst->chunks) {
+		dst->chunks = src->chunks;
+	} else {
+		/* behind the chunk dst is allocating from, which stays in front */
+		for (last = src->chunks; last->next; last = last->next)
+			;
+		last->next = dst->chunks->next;
+		dst->chunks->next = src->chunks;
+	}
+
+	src->chunks = NULL;
+}
+
+/*
+ * Count size more bytes against the memory limit of doc, false if that is
+ * too many.  The parser's own buffers count as well as the document.
+ */
+bool
+toml_charge(struct toml_document* doc, size_t size)
+{
+	if (!doc->limits.max_memory)
+		return true;
+
+	if (size > doc->limits.max_memory - doc->allocated) {
+		doc->limit = "memory limit reached";
+		return false;
+	}
+
+	doc->allocated += size;
+	return true;
+}
+
+/* Give back what was counted for something since freed */
+void
+toml_uncharge(struct toml_document* doc, size_t size)
+{
+	doc->allocated -= size < doc->allocated ? size : doc->allocated;
+}
+
+/* One more node for doc, false if that is one too many */
+bool
+toml_count_node(struct toml_document* doc)
+{
+	if (!doc->limits.max_nodes)
+		return true;
+
+	if (doc->nodes == doc->limits.max_nodes) {
+		doc->limit = "too many nodes";
+		return false;
+	}
+
+	doc->nodes++;
+	return true;
+}
+
+/* A node counted but never added, or since taken out */
+void
+toml_uncount_node(struct toml_document* doc)
+{
+	if (doc->nodes)
+		doc->nodes--;
+}
+
+void*
+toml_alloc(struct toml_document* doc, size_t size)
+{
+	if (!toml_charge(doc, size))
+		return NULL;
+
+	if (doc->arena)
+		return toml_arena_alloc(doc->arena, size);
+
+	return malloc(size);
+}
+
+void
+toml_release(struct toml_document* doc, void* ptr)
+{
+	if (!doc->arena)
+		free(ptr);
+}
+
+char*
+toml_strndup(struct toml_document* doc, const char* str, size_t len)
+{
+	char* ret;
+
+	ret = toml_alloc(doc, len + 1);
+	if (!ret)
+		return NULL;
+
+	memcpy(ret, str, len);
+	ret[len] = 0;
+
+	return ret;
+}
+
+/* Let nodes of doc point into buf for as long as doc lives */
+int
+toml_borrow(struct toml_document* doc, const char* buf, size_t len)
+{
+	struct toml_borrowed* borrowed;
+
+	borrowed = toml_alloc(doc, sizeof(*borrowed));
+	if (!borrowed)
+		return ENOMEM;
+
+	borrowed->start = buf;
+	borrowed->end = buf + len;
+	borrowed->next = doc->borrowed;
+	doc->borrowed = borrowed;
+
+	return 0;
+}
+
+bool
+toml_is_borrowed(struct toml_document* doc, const char* ptr)
+{
+	struct toml_borrowed* borrowed;
+
+	for (borrowed = doc->borrowed; borrowed; borrowed = borrowed->next) {
+		if (ptr >= borrowed->start && ptr < borrowed->end)
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * A string that stays valid for the lifetime of doc: str itself if it lies in
+ * a buffer lent to doc, otherwise a copy.
+ */
+char*
+toml_strview(struct toml_document* doc, const char* str, size_t len)
+{
+	if (toml_is_borrowed(doc, str))
+		return (char*)str;
+
+	return toml_strndup(doc, str, len);
+}
@@ -0,0 +1,556 @@
+#include "toml.h"
+#include "toml_private.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Binding runs the event parser and writes each value it reports straight
+ * into the caller's structures, so no nodes are made at all.
+ *
+ * Where the parser is in the document is kept as a stack of frames, one for
+ * the current table and one more for each inline table open inside it.  A
+ * frame has the bindings that names are looked up in and the structure they
+ * are relative to.  A binding's path may run over several names, so a frame
+ * also holds the names seen since that structure that only begin a path;
+ * these are kept NUL separated in scratch, as the parser's copies do not last.
+ */
+
+struct bind_frame {
+	const struct toml_binding*	fields;	/* NULL if nothing is bound here */
+	const struct toml_binding*	bound;	/* the binding a name reached */
+	char*						base;
+	size_t						names;	/* in scratch, the partial path */
+	size_t						end;
+	int							lists;	/* arrays open in this frame */
+	const struct toml_binding*	list;	/* what the outermost one is bound to */
+	char*						list_base;
+};
+
+struct bind_state {
+	unsigned int				flags;
+	struct bind_frame*			frames;
+	size_t						depth;
+	size_t						size;
+	struct bind_frame			target;	/* what the last key reached */
+	struct toml_writer			scratch;
+};
+
+enum match {
+	MATCH_NONE,
+	MATCH_PREFIX,
+	MATCH_FULL,
+};
+
+#define TOP(s)		(&(s)->frames[(s)->depth - 1])
+
+/* Whether the names in scratch from names to end are path, or begin it */
+static enum match
+match_path(struct bind_state* s, const char* path, size_t names, size_t end)
+{
+	const char*	name;
+	size_t		len;
+
+	while (names < end) {
+		path = toml_path_segment(path, &name, &len);
+		if (!path || len != strlen(s->scratch.buf + names) ||
+							memcmp(name, s->scratch.buf + names, len))
+			return MATCH_NONE;
+
+		names += len + 1;
+		if (!*path)
+			return names == end ? MATCH_FULL : MATCH_NONE;
+		path++;
+	}
+
+	return MATCH_PREFIX;
+}
+
+/* Name looked up from frame, with the frame it leads to */
+static int
+bind_resolve(struct bind_state* s, const struct bind_frame* frame,
+							const char* name, size_t len, struct bind_frame* to)
+{
+	const struct toml_binding*	b;
+	bool						prefix = false;
+
+	memset(to, 0, sizeof(*to));
+	if (!frame->fields)
+		goto unbound;
+
+	s->scratch.len = frame->end;
+	toml_write(&s->scratch, name, len);
+	toml_write(&s->scratch, "", 1);
+	if (s->scratch.error)
+		return s->scratch.error;
+
+	for (b = frame->fields; b->path; b++) {
+		switch (match_path(s, b->path, frame->names, s->scratch.len)) {
+		case MATCH_FULL:
+			to->bound = b;
+			to->base = frame->base;
+			to->names = to->end = s->scratch.len;
+			return 0;
+
+		case MATCH_PREFIX:
+			prefix = true;
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	if (prefix) {
+		to->fields = frame->fields;
+		to->base = frame->base;
+		to->names = frame->names;
+		to->end = s->scratch.len;
+		return 0;
+	}
+
+unbound:
+	to->end = frame->end;
+	return s->flags & TOML_BIND_STRICT ? ENOENT : 0;
+}
+
+/* Into the table frame reached, the last element of a table array */
+static int
+bind_descend(struct bind_frame* frame)
+{
+	const struct toml_binding*	b = frame->bound;
+	size_t						count;
+
+	if (!b)
+		return 0;
+
+	frame->bound = NULL;
+	switch (b->type) {
+	case TOML_BIND_TABLE:
+		frame->fields = b->fields;
+		frame->base += b->offset;
+		return 0;
+
+	case TOML_BIND_TABLE_ARRAY:
+		count = *(size_t*)(frame->base + b->count_offset);
+		if (!count)
+			return ENOENT;
+		frame->fields = b->fields;
+		frame->base += b->offset + (count - 1) * b->stride;
+		return 0;
+
+	default:
+		return EINVAL;
+	}
+}
+
+/* Start another element of a table array */
+static int
+bind_append(struct bind_frame* frame)
+{
+	const struct toml_binding*	b = frame->bound;
+	size_t*						count;
+
+	count = (size_t*)(frame->base + b->count_offset);
+	if ((*count + 1) * b->stride > b->size)
+		return ERANGE;
+
+	(*count)++;
+
+	return bind_descend(frame);
+}
+
+static int
+bind_push(struct bind_state* s, const struct bind_frame* frame)
+{
+	struct bind_frame*	frames;
+	size_t				size = s->size ? s->size * 2 : 8;
+
+	if (s->depth == s->size) {
+		frames = realloc(s->frames, size * sizeof(*frames));
+		if (!frames)
+			return ENOMEM;
+		s->frames = frames;
+		s->size = size;
+	}
+
+	s->frames[s->depth++] = *frame;
+
+	return 0;
+}
+
+/* Back to the root frame, before resolving a table header */
+static void
+bind_reset(struct bind_state* s)
+{
+	s->depth = 1;
+	s->scratch.len = 0;
+}
+
+/* Walk a table header's names, all but the last */
+static int
+bind_header(struct bind_state* s, const char* name, size_t len,
+													struct bind_frame* to)
+{
+	const char*			end = name + len;
+	const char*			dot;
+	struct bind_frame	frame = s->frames[0];
+	int					ret;
+
+	bind_reset(s);
+
+	for (;;) {
+		dot = memchr(name, '.', end - name);
+		if (!dot)
+			break;
+
+		ret = bind_resolve(s, &frame, name, dot - name, to);
+		if (!ret)
+			ret = bind_descend(to);
+		if (ret)
+			return ret;
+
+		frame = *to;
+		name = dot + 1;
+	}
+
+	return bind_resolve(s, &frame, name, end - name, to);
+}
+
+static int
+bind_table(void* ctx, const char* name, size_t len)
+{
+	struct bind_state*	s = ctx;
+	struct bind_frame	frame;
+	int					ret;
+
+	ret = bind_header(s, name, len, &frame);
+	if (!ret)
+		ret = bind_descend(&frame);
+	if (!ret)
+		ret = bind_push(s, &frame);
+
+	return ret;
+}
+
+static int
+bind_table_array(void* ctx, const char* name, size_t len)
+{
+	struct bind_state*	s = ctx;
+	struct bind_frame	frame;
+	int					ret;
+
+	ret = bind_header(s, name, len, &frame);
+	if (ret)
+		return ret;
+
+	if (frame.bound) {
+		if (frame.bound->type != TOML_BIND_TABLE_ARRAY)
+			return EINVAL;
+		ret = bind_append(&frame);
+	} else if (frame.fields) {
+		/* the start of a path, but not of a table array */
+		return EINVAL;
+	}
+
+	return ret ? ret : bind_push(s, &frame);
+}
+
+static int
+bind_key(void* ctx, const char* name, size_t len)
+{
+	struct bind_state* s = ctx;
+
+	return bind_resolve(s, TOP(s), name, len, &s->target);
+}
+
+static int
+bind_int(const char* raw, size_t len, size_t size, char* to)
+{
+	char		buf[32];
+	size_t		i, n = 0;
+	long long	v;
+
+	for (i = 0; i < len; i++) {
+		if (raw[i] == '_' || raw[i] == '+')
+			continue;
+		if (n == sizeof(buf) - 1)
+			return ERANGE;
+		buf[n++] = raw[i];
+	}
+	buf[n] = '\0';
+
+	errno = 0;
+	v = strtoll(buf, NULL, 10);
+	if (errno)
+		return errno;
+
+	switch (size) {
+	case 1:
+		if (v < INT8_MIN || v > INT8_MAX)
+			return ERANGE;
+		*(int8_t*)to = v;
+		return 0;
+
+	case 2:
+		if (v < INT16_MIN || v > INT16_MAX)
+			return ERANGE;
+		*(int16_t*)to = v;
+		return 0;
+
+	case 4:
+		if (v < INT32_MIN || v > INT32_MAX)
+			return ERANGE;
+		*(int32_t*)to = v;
+		return 0;
+
+	case 8:
+		*(int64_t*)to = v;
+		return 0;
+
+	default:
+		return EINVAL;
+	}
+}
+
+/* Take n digits from *raw */
+static int
+bind_digits(const char** raw, int n)
+{
+	int v = 0;
+
+	while (n--)
+		v = v * 10 + *(*raw)++ - '0';
+
+	return v;
+}
+
+/* A date as the parser spelt it, which it has already found well formed */
+static int
+bind_date(const char* raw, size_t len, struct toml_datetime* date)
+{
+	const char*	end = raw + len;
+	int64_t		year = 0;
+	int			month, day, hour, minute, second, offset = 0;
+	int			digits = 0;
+	long		nsec = 0;
+	bool		negative = *raw == '-';
+
+	if (negative)
+		raw++;
+	while (*raw != '-')
+		year = year * 10 + *raw++ - '0';
+	if (negative)
+		year = -year;
+	raw++;
+	month = bind_digits(&raw, 2);
+	raw++;
+	day = bind_digits(&raw, 2);
+	raw++;
+	hour = bind_digits(&raw, 2);
+	raw++;
+	minute = bind_digits(&raw, 2);
+	raw++;
+	second = bind_digits(&raw, 2);
+
+	if (raw < end && *raw == '.') {
+		for (raw++; raw < end && *raw >= '0' && *raw <= '9'; raw++) {
+			if (digits++ < 9)
+				nsec = nsec * 10 + *raw - '0';
+		}
+		for (; digits < 9; digits++)
+			nsec *= 10;
+	}
+
+	date->zulu = raw < end && *raw == 'Z';
+	if (raw < end && !date->zulu) {
+		negative = *raw++ == '-';
+		offset = bind_digits(&raw, 2) * 60;
+		raw++;
+		offset += bind_digits(&raw, 2);
+		if (negative)
+			offset = -offset;
+	}
+
+	if (!toml_epoch(year, month, day, hour, minute, second, offset, &date->epoch))
+		return EINVAL;
+	date->nsec = nsec;
+	date->offset = offset;
+
+	return 0;
+}
+
+static int
+bind_store(const struct toml_binding* b, char* base, enum toml_type type,
+												const char* raw, size_t len)
+{
+	char*	to = base + b->offset;
+	double	d;
+
+	switch (b->type) {
+	case TOML_BIND_INT:
+		if (type != TOML_INT)
+			return EINVAL;
+		return bind_int(raw, len, b->size, to);
+
+	case TOML_BIND_DOUBLE:
+		if (type != TOML_FLOAT && type != TOML_INT)
+			return EINVAL;
+		d = toml_strtod(raw, len);
+		if (b->size == sizeof(float))
+			*(float*)to = d;
+		else if (b->size == sizeof(double))
+			*(double*)to = d;
+		else
+			return EINVAL;
+		return 0;
+
+	case TOML_BIND_BOOL:
+		if (type != TOML_BOOLEAN)
+			return EINVAL;
+		return bind_int(*raw == 't' ? "1" : "0", 1, b->size, to);
+
+	case TOML_BIND_STRING:
+		if (type != TOML_STRING)
+			return EINVAL;
+		if (len >= b->size)
+			return ERANGE;
+		memcpy(to, raw, len);
+		to[len] = '\0';
+		return 0;
+
+	case TOML_BIND_DATE:
+		if (type != TOML_DATE)
+			return EINVAL;
+		return bind_date(raw, len, (struct toml_datetime*)to);
+
+	default:
+		return EINVAL;
+	}
+}
+
+static int
+bind_value(void* ctx, enum toml_type type, const char* raw, size_t len)
+{
+	struct bind_state*	s = ctx;
+	struct bind_frame*	top = TOP(s);
+
+	/* arrays of anything but inline tables are not bound */
+	if (top->lists)
+		return top->list && top->lists == 1 ? EINVAL : 0;
+
+	s->scratch.len = top->end;
+	if (s->target.bound)
+		return bind_store(s->target.bound, s->target.base, type, raw, len);
+
+	/* a value where a table was expected */
+	return s->target.fields ? EINVAL : 0;
+}
+
+static int
+bind_begin_array(void* ctx)
+{
+	struct bind_state*	s = ctx;
+	struct bind_frame*	top = TOP(s);
+
+	if (top->lists++)
+		return 0;
+
+	top->list = s->target.bound;
+	top->list_base = s->target.base;
+	if (s->target.fields || (top->list &&
+								top->list->type != TOML_BIND_TABLE_ARRAY))
+		return EINVAL;
+
+	return 0;
+}
+
+static int
+bind_end_array(void* ctx)
+{
+	struct bind_state*	s = ctx;
+	struct bind_frame*	top = TOP(s);
+
+	if (!--top->lists)
+		s->scratch.len = top->end;
+
+	return 0;
+}
+
+static int
+bind_begin_inline_table(void* ctx)
+{
+	struct bind_state*	s = ctx;
+	struct bind_frame*	top = TOP(s);
+	struct bind_frame	frame;
+	int					ret = 0;
+
+	if (top->lists) {
+		/* an element of an array of tables */
+		memset(&frame, 0, sizeof(frame));
+		frame.names = frame.end = top->end;
+		if (top->list && top->lists == 1) {
+			frame.bound = top->list;
+			frame.base = top->list_base;
+			ret = bind_append(&frame);
+		}
+	} else {
+		frame = s->target;
+		ret = bind_descend(&frame);
+	}
+
+	if (!ret) {
+		frame.lists = 0;
+		frame.list = NULL;
+		frame.list_base = NULL;
+		ret = bind_push(s, &frame);
+	}
+
+	return ret;
+}
+
+static int
+bind_end_inline_table(void* ctx)
+{
+	struct bind_state* s = ctx;
+
+	s->depth--;
+	s->scratch.len = TOP(s)->end;
+
+	return 0;
+}
+
+static const struct toml_events bind_events = {
+	.begin_table = bind_table,
+	.begin_table_array = bind_table_array,
+	.key = bind_key,
+	.value = bind_value,
+	.begin_array = bind_begin_array,
+	.end_array = bind_end_array,
+	.begin_inline_table = bind_begin_inline_table,
+	.end_inline_table = bind_end_inline_table,
+};
+
+int
+toml_bind(char* buf, int len, const struct toml_binding* fields, void* out,
+														unsigned int flags)
+{
+	struct bind_state	s = { 0 };
+	struct bind_frame	root = { 0 };
+	int					ret;
+
+	s.flags = flags;
+	toml_writer_init(&s.scratch, TOML_WRITER_BUFFER, NULL, 0);
+
+	root.fields = fields;
+	root.base = out;
+	ret = bind_push(&s, &root);
+	if (!ret)
+		ret = toml_parse_events(buf, len, &bind_events, &s);
+
+	free(s.frames);
+	free(s.scratch.buf);
+
+	return ret;
+}
@@ -0,0 +1,153 @@
+#include "toml.h"
+#include "toml_private.h"
+
+#include <string.h>
+
+/*
+ * Dates go to seconds since the epoch and back by plain calendar arithmetic
+ * (Howard Hinnant's days_from_civil() and civil_from_days()), which unlike
+ * timegm() and gmtime_r() never look at the time zone or take a lock.
+ */
+
+static int64_t
+days_from_civil(int64_t y, int m, int d)
+{
+	int64_t		era;
+	unsigned	yoe, doy, doe;
+
+	y -= m <= 2;
+	era = (y >= 0 ? y : y - 399) / 400;
+	yoe = (unsigned)(y - era * 400);
+	doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+	doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+	return era * 146097 + (int64_t)doe - 719468;
+}
+
+static void
+civil_from_days(int64_t z, int64_t* y, int* m, int* d)
+{
+	int64_t		era;
+	unsigned	doe, yoe, doy, mp;
+
+	z += 719468;
+	era = (z >= 0 ? z : z - 146096) / 146097;
+	doe = (unsigned)(z - era * 146097);
+	yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	mp = (5 * doy + 2) / 153;
+
+	*d = doy - (153 * mp + 2) / 5 + 1;
+	*m = mp < 10 ? mp + 3 : mp - 9;
+	*y = (int64_t)yoe + era * 400 + (*m <= 2);
+}
+
+static int
+days_in_month(int64_t y, int m)
+{
+	static const int days[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+
+	if (m == 2 && y % 4 == 0 && (y % 100 != 0 || y % 400 == 0))
+		return 29;
+
+	return days[m - 1];
+}
+
+/*
+ * Seconds since the epoch of a wall clock time offset minutes ahead of UTC,
+ * false if there is no such time.  A leap second is taken as the first second
+ * of the next minute.
+ */
+bool
+toml_epoch(int64_t year, int month, int day, int hour, int minute, int second,
+												int offset, time_t* epoch)
+{
+	if (month < 1 || month > 12 || day < 1 || day > days_in_month(year, month) ||
+								hour > 23 || minute > 59 || second > 60)
+		return false;
+
+	*epoch = days_from_civil(year, month, day) * 86400 + hour * 3600 +
+									minute * 60 + second - offset * 60;
+
+	return true;
+}
+
+/* Write value as width digits at the end of p, returning the new start */
+static char*
+put_digits(char* p, uint64_t value, int width)
+{
+	do {
+		*--p = '0' + value % 10;
+		value /= 10;
+	} while (--width > 0 || value);
+
+	return p;
+}
+
+size_t
+toml_format_date(struct toml_node* node, char* buf, size_t size)
+{
+	char				out[TOML_DATE_MAX];
+	char*				p = out + sizeof(out);
+	int64_t				local, days, secs, year;
+	int					month, day, offset;
+	size_t				len;
+	struct toml_node	view;
+
+	node = toml_view(node, &view);
+	if (node->type != TOML_DATE) {
+		if (size)
+			*buf = '\0';
+		return 0;
+	}
+
+	offset = node->value.rfc3339_time.offset;
+	local = node->value.rfc3339_time.epoch + offset * 60;
+	days = local / 86400;
+	secs = local % 86400;
+	if (secs < 0) {
+		secs += 86400;
+		days--;
+	}
+	civil_from_days(days, &year, &month, &day);
+
+	/* built back to front */
+	if (node->value.rfc3339_time.offset_is_zulu) {
+		*--p = 'Z';
+	} else {
+		if (offset < 0)
+			offset = -offset;
+		p = put_digits(p, offset % 60, 2);
+		*--p = ':';
+		p = put_digits(p, offset / 60, 2);
+		*--p = node->value.rfc3339_time.offset_sign_negative ? '-' : '+';
+	}
+
+	if (node->value.rfc3339_time.sec_frac_digits) {
+		p = put_digits(p, node->value.rfc3339_time.sec_frac,
+							node->value.rfc3339_time.sec_frac_digits);
+		*--p = '.';
+	}
+
+	p = put_digits(p, secs % 60, 2);
+	*--p = ':';
+	p = put_digits(p, secs / 60 % 60, 2);
+	*--p = ':';
+	p = put_digits(p, secs / 3600, 2);
+	*--p = 'T';
+	p = put_digits(p, day, 2);
+	*--p = '-';
+	p = put_digits(p, month, 2);
+	*--p = '-';
+	p = put_digits(p, year < 0 ? -year : year, 4);
+	if (year < 0)
+		*--p = '-';
+
+	len = out + sizeof(out) - p;
+	if (size) {
+		memcpy(buf, p, len < size ? len : size - 1);
+		buf[len < size ? len : size - 1] = '\0';
+	}
+
+	return len;
+}
@@ -0,0 +1,130 @@
+#include "toml.h"
+#include "toml_private.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+
+/*
+ * A handle holds the current document of something that is reloaded while
+ * other threads read it.  Readers take no lock: they count themselves in on
+ * one of two counters, the one picked by the parity of the handle's epoch,
+ * and read the document pointer.  A new document is published by swapping
+ * that pointer, after which the epoch is moved on so that new readers count
+ * on the other counter, and once the old counter drains no reader can still
+ * hold the old document and it is freed.  Reloads are serialised among
+ * themselves and wait for readers, readers never wait.
+ */
+
+struct toml_handle {
+	struct toml_node*	root;
+	unsigned int		epoch;
+	unsigned long		readers[2];
+	pthread_mutex_t		lock;		/* one reload at a time */
+};
+
+struct toml_handle*
+toml_handle_new(struct toml_node* root)
+{
+	struct toml_handle* handle;
+
+	handle = malloc(sizeof(*handle));
+	if (!handle)
+		return NULL;
+
+	handle->root = root;
+	handle->epoch = 0;
+	handle->readers[0] = handle->readers[1] = 0;
+	pthread_mutex_init(&handle->lock, NULL);
+
+	return handle;
+}
+
+/*
+ * The current document, good until toml_handle_release() is called with the
+ * ticket stored in *ticket.
+ */
+struct toml_node*
+toml_handle_acquire(struct toml_handle* handle, unsigned int* ticket)
+{
+	unsigned int epoch;
+
+	for (;;) {
+		epoch = __atomic_load_n(&handle->epoch, __ATOMIC_SEQ_CST);
+		__atomic_fetch_add(&handle->readers[epoch & 1], 1, __ATOMIC_SEQ_CST);
+
+		/* a reload that moved the epoch meanwhile may not have seen us */
+		if (__atomic_load_n(&handle->epoch, __ATOMIC_SEQ_CST) == epoch)
+			break;
+
+		__atomic_fetch_sub(&handle->readers[epoch & 1], 1, __ATOMIC_SEQ_CST);
+	}
+
+	*ticket = epoch;
+	return __atomic_load_n(&handle->root, __ATOMIC_SEQ_CST);
+}
+
+void
+toml_handle_release(struct toml_handle* handle, unsigned int ticket)
+{
+	__atomic_fetch_sub(&handle->readers[ticket & 1], 1, __ATOMIC_RELEASE);
+}
+
+/* Publish root in place of the current document, and free that */
+void
+toml_handle_swap(struct toml_handle* handle, struct toml_node* root)
+{
+	struct toml_node*	old;
+	unsigned int		epoch;
+
+	pthread_mutex_lock(&handle->lock);
+
+	old = __atomic_exchange_n(&handle->root, root, __ATOMIC_SEQ_CST);
+
+	epoch = __atomic_fetch_add(&handle->epoch, 1, __ATOMIC_SEQ_CST);
+	while (__atomic_load_n(&handle->readers[epoch & 1], __ATOMIC_ACQUIRE))
+		sched_yield();
+
+	pthread_mutex_unlock(&handle->lock);
+
+	if (old)
+		toml_free(old);
+}
+
+/*
+ * Parse buf into a new document and publish it.  If buf does not parse the
+ * current document stays.  Documents that are read from several threads
+ * cannot be parsed lazily, so TOML_PARSE_LAZY is ignored.
+ */
+int
+toml_handle_reload(struct toml_handle* handle, char* buf, int buflen,
+										const struct toml_parse_opts* opts)
+{
+	struct toml_parse_opts	o = { 0 };
+	struct toml_node*		root;
+
+	if (opts)
+		o = *opts;
+	o.flags &= ~TOML_PARSE_LAZY;
+
+	if (toml_init(&root))
+		return 1;
+
+	if (toml_parse_with_opts(root, buf, buflen, &o)) {
+		toml_free(root);
+		return 1;
+	}
+
+	toml_handle_swap(handle, root);
+	return 0;
+}
+
+/* Once no thread reads through it any more */
+void
+toml_handle_free(struct toml_handle* handle)
+{
+	if (handle->root)
+		toml_free(handle->root);
+	pthread_mutex_destroy(&handle->lock);
+	free(handle);
+}
@@ -0,0 +1,296 @@
+#include "toml_private.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+/*
+ * Tables keep their children on an ordered list.  Once a table has grown past
+ * INDEX_THRESHOLD named children a hash index is built next to that list so
+ * that finding a child by name no longer means walking all of its siblings.
+ */
+
+#define INDEX_THRESHOLD	8
+#define INDEX_MIN_SLOTS	16
+
+struct toml_index_slot {
+	uint32_t			hash;
+	struct toml_node*	node;
+};
+
+struct toml_table_index {
+	uint32_t				mask;
+	uint32_t				count;
+	struct toml_index_slot	slots[];
+};
+
+uint32_t
+toml_hash(const char* name, size_t len)
+{
+	uint32_t	hash = 2166136261u;
+	size_t		i;
+
+	for (i = 0; i < len; i++) {
+		hash ^= (uint8_t)name[i];
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+static bool
+is_table(struct toml_node* node)
+{
+	switch (node->type) {
+	case TOML_ROOT:
+	case TOML_TABLE:
+	case TOML_INLINE_TABLE:
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+static bool
+name_matches(struct toml_node* node, const char* name, size_t len)
+{
+	return node->name && node->name_len == len &&
+											memcmp(node->name, name, len) == 0;
+}
+
+static void
+index_put(struct toml_table_index* index, uint32_t hash, struct toml_node* node)
+{
+	uint32_t i = hash & index->mask;
+
+	while (index->slots[i].node)
+		i = (i + 1) & index->mask;
+
+	index->slots[i].hash = hash;
+	index->slots[i].node = node;
+	index->count++;
+}
+
+static size_t
+index_bytes(uint32_t slots)
+{
+	return sizeof(struct toml_table_index) + slots * sizeof(struct toml_index_slot);
+}
+
+size_t
+toml_index_size(struct toml_table_index* index)
+{
+	return index_bytes(index->mask + 1);
+}
+
+static struct toml_table_index*
+index_new(struct toml_document* doc, uint32_t slots)
+{
+	struct toml_table_index* index;
+
+	index = toml_alloc(doc, index_bytes(slots));
+	if (!index)
+		return NULL;
+
+	index->mask = slots - 1;
+	index->count = 0;
+	memset(index->slots, 0, slots * sizeof(index->slots[0]));
+
+	return index;
+}
+
+static int
+index_build(struct toml_document* doc, struct toml_node* table)
+{
+	struct toml_table_item*		item;
+	struct toml_table_index*	index;
+	uint32_t					children = 0;
+	uint32_t					slots = INDEX_MIN_SLOTS;
+
+	list_for_each(&table->value.map, item, map)
+		children++;
+
+	while (slots < children * 2)
+		slots *= 2;
+
+	index = index_new(doc, slots);
+	if (!index)
+		return ENOMEM;
+
+	list_for_each(&table->value.map, item, map) {
+		if (!item->node.name)
+			continue;
+
+		index_put(index, toml_hash(item->node.name, item->node.name_len),
+																&item->node);
+	}
+
+	table->index = index;
+	return 0;
+}
+
+static int
+index_grow(struct toml_document* doc, struct toml_node* table)
+{
+	struct toml_table_index*	old = table->index;
+	struct toml_table_index*	index;
+	uint32_t					i;
+
+	index = index_new(doc, (old->mask + 1) * 2);
+	if (!index)
+		return ENOMEM;
+
+	for (i = 0; i <= old->mask; i++) {
+		if (old->slots[i].node)
+			index_put(index, old->slots[i].hash, old->slots[i].node);
+	}
+
+	toml_uncharge(doc, toml_index_size(old));
+	toml_release(doc, old);
+	table->index = index;
+	return 0;
+}
+
+/* Drop the index of table, to be built again if it grows big enough */
+void
+toml_index_release(struct toml_document* doc, struct toml_node* table)
+{
+	if (!table->index)
+		return;
+
+	toml_uncharge(doc, toml_index_size(table->index));
+	toml_release(doc, table->index);
+	table->index = NULL;
+}
+
+static struct toml_node*
+index_find(struct toml_table_index* index, const char* name, size_t len,
+																uint32_t hash)
+{
+	uint32_t i = hash & index->mask;
+
+	for (; index->slots[i].node; i = (i + 1) & index->mask) {
+		if (index->slots[i].hash == hash &&
+						name_matches(index->slots[i].node, name, len))
+			return index->slots[i].node;
+	}
+
+	return NULL;
+}
+
+/*
+ * Find the child of table called name.  Tables without an index are searched
+ * linearly, and if doc is given and the table turned out to be big enough an
+ * index is built on the spot.
+ */
+struct toml_node*
+toml_table_lookup(struct toml_document* doc, struct toml_node* table,
+												const char* name, size_t len)
+{
+	struct toml_table_item*	item;
+	uint32_t				children = 0;
+
+	if (toml_is_flat(table))
+		return toml_flat_lookup(table, name, len, toml_hash(name, len));
+
+	if (!is_table(table))
+		return NULL;
+
+	if (toml_is_lazy(table) && toml_lazy_load(table))
+		return NULL;
+
+	if (table->index)
+		return index_find(table->index, name, len, toml_hash(name, len));
+
+	list_for_each(&table->value.map, item, map) {
+		if (!item->node.name)
+			continue;
+
+		if (name_matches(&item->node, name, len))
+			return &item->node;
+
+		if (++children == INDEX_THRESHOLD && doc && !index_build(doc, table))
+			return toml_table_lookup(NULL, table, name, len);
+	}
+
+	return NULL;
+}
+
+/* As toml_table_lookup() for a name whose hash is already known */
+struct toml_node*
+toml_table_lookup_hashed(struct toml_node* table, const char* name,
+												size_t len, uint32_t hash)
+{
+	if (toml_is_flat(table))
+		return toml_flat_lookup(table, name, len, hash);
+
+	if (is_table(table) && toml_is_lazy(table) && toml_lazy_load(table))
+		return NULL;
+
+	if (is_table(table) && table->index)
+		return index_find(table->index, name, len, hash);
+
+	return toml_table_lookup(NULL, table, name, len);
+}
+
+/*
+ * The named children of table.  Past INDEX_THRESHOLD the index is built so
+ * that the next count is not another walk.
+ */
+static uint32_t
+table_keys(struct toml_document* doc, struct toml_node* table)
+{
+	struct toml_table_item*	item;
+	uint32_t				children = 0;
+
+	if (table->index)
+		return table->index->count;
+
+	list_for_each(&table->value.map, item, map) {
+		if (item->node.name && ++children == INDEX_THRESHOLD &&
+												!index_build(doc, table))
+			return table->index->count;
+	}
+
+	return children;
+}
+
+/*
+ * Append item to table, keeping the index of the table in step.  Whatever
+ * adds to a table comes through here, so here too the limits on keys and
+ * nodes are kept.  A failure leaves the table as it was.
+ */
+int
+toml_table_add(struct toml_document* doc, struct toml_node* table,
+												struct toml_table_item* item)
+{
+	struct toml_table_index* index;
+
+	/* the body goes ahead of anything added later */
+	if (toml_is_lazy(table) && toml_lazy_load(table))
+		return EINVAL;
+
+	if (doc->limits.max_keys && item->node.name &&
+						table_keys(doc, table) >= doc->limits.max_keys) {
+		doc->limit = "too many keys";
+		return E2BIG;
+	}
+
+	index = item->node.name ? table->index : NULL;
+	if (index && (index->count + 1) * 4 > (index->mask + 1) * 3) {
+		if (index_grow(doc, table))
+			return ENOMEM;
+		index = table->index;
+	}
+
+	if (!toml_count_node(doc))
+		return E2BIG;
+
+	list_add_tail(&table->value.map, &item->map);
+
+	if (index)
+		index_put(index, toml_hash(item->node.name, item->node.name_len),
+																&item->node);
+	return 0;
+}
@@ -0,0 +1,222 @@
+#include "toml.h"
+#include "toml_private.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * A lazy parse reads only what comes before the first table header and the
+ * headers themselves, which makes all the tables, and notes where each
+ * table's body lies.  A body is parsed into its table the first time the
+ * table is looked into, by a lookup or by stepping through its children,
+ * so the cost of a lookup is that of the tables on its path rather than of
+ * the whole document.
+ */
+
+struct outline {
+	char*				end;
+	struct toml_span*	v;
+	size_t				count;
+	size_t				size;
+};
+
+static bool
+outline_header(void* ctx, char* header, char* eol, int line)
+{
+	struct outline*		o = ctx;
+	struct toml_span*	v;
+
+	if (o->count == o->size) {
+		size_t size = o->size ? o->size * 2 : 64;
+
+		v = realloc(o->v, size * sizeof(*v));
+		if (!v) {
+			free(o->v);
+			o->v = NULL;
+			return false;
+		}
+		o->v = v;
+		o->size = size;
+	}
+
+	/* the header's line, newline and all */
+	o->v[o->count].start = header;
+	o->v[o->count].len = eol - header + (eol < o->end);
+	o->v[o->count].line = line;
+	o->count++;
+
+	return true;
+}
+
+static struct toml_lazy*
+lazy_of(struct toml_node* table)
+{
+	return (struct toml_lazy*)((uintptr_t)table->index & ~(uintptr_t)1);
+}
+
+/*
+ * The spans of buf's table header lines, each with its newline, after a first
+ * span that is whatever comes before the first header.  NULL if out of memory.
+ */
+struct toml_span*
+toml_outline(char* buf, size_t len, size_t* count)
+{
+	struct outline o = { .end = buf + len };
+
+	if (!outline_header(&o, buf, buf, 1))
+		return NULL;
+	toml_scan_headers(buf, len, outline_header, &o);
+	if (!o.v)
+		return NULL;
+	o.v[0].len = (o.count > 1 ? o.v[1].start : buf + len) - buf;
+
+	*count = o.count;
+	return o.v;
+}
+
+/* The body of the table whose header is spans[i], up to the next header */
+void
+toml_outline_body(const struct toml_span* spans, size_t count, size_t i,
+										char* end, struct toml_span* body)
+{
+	body->start = spans[i].start + (i ? spans[i].len : 0);
+	body->len = (i + 1 < count ? spans[i + 1].start : end) - body->start;
+	body->line = spans[i].line + (i ? 1 : 0);
+}
+
+int
+toml_parse_lazy(struct toml_node* toml_root, char* buf, size_t len,
+														unsigned int flags)
+{
+	struct toml_document*	doc = toml_document(toml_root);
+	struct toml_sections	log = { 0 };
+	struct toml_span*		spans;
+	struct toml_span		body;
+	struct toml_lazy*		lazy;
+	size_t					count, i;
+	int						ret = 1;
+
+	spans = toml_outline(buf, len, &count);
+	if (!spans)
+		goto nomem;
+
+	ret = toml_parse_spans(toml_root, spans, count, flags, &log);
+	if (ret)
+		goto out;
+
+	if (log.count != count - 1) {
+		fprintf(stderr, "table headers out of step\n");
+		ret = 1;
+		goto out;
+	}
+
+	for (i = 0; i < log.count; i++) {
+		toml_outline_body(spans, count, i + 1, buf + len, &body);
+		if (!body.len)
+			continue;
+
+		lazy = malloc(sizeof(*lazy));
+		if (!lazy)
+			goto nomem;
+
+		lazy->doc = doc;
+		lazy->table = log.v[i].table;
+		lazy->body = body;
+		lazy->flags = flags;
+		lazy->failed = false;
+		lazy->index = lazy->table->index;
+		lazy->next = doc->lazy;
+		doc->lazy = lazy;
+		lazy->table->index = (struct toml_table_index*)((uintptr_t)lazy | 1);
+	}
+
+	goto out;
+
+nomem:
+	fprintf(stderr, "malloc failed\n");
+	ret = 1;
+
+out:
+	free(spans);
+	free(log.v);
+
+	return ret;
+}
+
+/*
+ * Parse the keys of a table into it.  What the table has already came from
+ * later headers, and goes back behind the keys so that it reads as if parsed
+ * in order.
+ */
+int
+toml_parse_table(struct toml_document* doc, struct toml_node* table,
+							const struct toml_span* body, unsigned int flags)
+{
+	struct toml_table_item*	item;
+	size_t					headed = 0;
+	int						ret;
+
+	list_for_each(&table->value.map, item, map)
+		headed++;
+
+	ret = toml_parse_body(doc, table, body, flags);
+
+	while (headed--) {
+		item = list_top(&table->value.map, struct toml_table_item, map);
+		list_del(&item->map);
+		list_add_tail(&table->value.map, &item->map);
+	}
+
+	return ret;
+}
+
+/*
+ * Parse the body of a table that has not been looked into before.  A body
+ * that does not parse leaves its table marked, so that looking into it keeps
+ * failing rather than showing what was read before the error.
+ */
+int
+toml_lazy_load(struct toml_node* table)
+{
+	struct toml_lazy* lazy = lazy_of(table);
+
+	if (lazy->failed)
+		return 1;
+
+	table->index = lazy->index;
+	lazy->table = NULL;
+
+	if (!toml_parse_table(lazy->doc, table, &lazy->body, lazy->flags))
+		return 0;
+
+	lazy->failed = true;
+	lazy->doc->lazy_failed = true;
+	lazy->table = table;
+	lazy->index = table->index;
+	table->index = (struct toml_table_index*)((uintptr_t)lazy | 1);
+
+	return 1;
+}
+
+/* Whether the body of a lazily parsed table has turned out not to parse */
+bool
+toml_lazy_failed(struct toml_node* toml_root)
+{
+	return toml_document(toml_root)->lazy_failed;
+}
+
+/* Forget the bodies never read, leaving their tables as they are */
+void
+toml_lazy_free(struct toml_document* doc)
+{
+	struct toml_lazy *lazy, *next;
+
+	for (lazy = doc->lazy; lazy; lazy = next) {
+		next = lazy->next;
+		if (lazy->table)
+			lazy->table->index = lazy->index;
+		free(lazy);
+	}
+
+	doc->lazy = NULL;
+}
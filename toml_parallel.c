@@ -0,0 +1,261 @@
+#include "toml.h"
+#include "toml_private.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * A big document is cut up at its table headers and the pieces are parsed
+ * into documents of their own on a pool of threads.  The pieces are then
+ * merged into the real document in order by replaying their table headers
+ * through SawTable() and SawTableArray(), so tables come out, and clashes
+ * between them are caught, exactly as in a plain parse.
+ */
+
+#define MIN_SEGMENT			(256 * 1024)
+#define SEGMENTS_PER_THREAD	4
+
+struct segment {
+	char*					start;
+	size_t					len;
+	int						line;
+	struct toml_node*		root;
+	struct toml_sections	sections;
+	int						ret;
+};
+
+struct pool {
+	struct segment*		segments;
+	size_t				count;
+	size_t				next;
+	unsigned int		flags;		/* enum toml_parse_flags */
+	pthread_mutex_t		lock;
+};
+
+struct find {
+	char*			buf;
+	size_t			step;
+	struct segment*	segs;
+	size_t			count;
+	size_t			max;
+};
+
+static bool
+found_header(void* ctx, char* header, char* eol __attribute__((unused)), int line)
+{
+	struct find* f = ctx;
+
+	if ((size_t)(header - f->buf) >= f->count * f->step) {
+		f->segs[f->count].start = header;
+		f->segs[f->count].line = line;
+		f->count++;
+	}
+
+	return f->count < f->max;
+}
+
+/*
+ * Cut buf into at most max segments of roughly step bytes, each but the first
+ * starting at a table header.
+ */
+static size_t
+find_segments(char* buf, size_t len, size_t step, struct segment* segs, size_t max)
+{
+	struct find	f = { buf, step, segs, 1, max };
+	size_t		i;
+
+	segs[0].start = buf;
+	segs[0].line = 1;
+
+	if (max > 1)
+		toml_scan_headers(buf, len, found_header, &f);
+
+	for (i = 0; i < f.count; i++)
+		segs[i].len = (i + 1 < f.count ? segs[i + 1].start : buf + len) - segs[i].start;
+
+	return f.count;
+}
+
+static void*
+worker(void* arg)
+{
+	struct pool*	pool = arg;
+	struct segment*	seg;
+	size_t			i;
+
+	for (;;) {
+		pthread_mutex_lock(&pool->lock);
+		i = pool->next++;
+		pthread_mutex_unlock(&pool->lock);
+
+		if (i >= pool->count)
+			break;
+
+		seg = &pool->segments[i];
+		seg->ret = toml_parse_segment(seg->root, seg->start, seg->len,
+									seg->line, pool->flags, &seg->sections);
+	}
+
+	return NULL;
+}
+
+/*
+ * Move what was put straight into from over to to.  Tables made by headers
+ * are left behind, replaying the headers makes them again.  Errors are left
+ * for the plain parse done instead to report.
+ */
+static int
+move_children(struct toml_document* doc, struct toml_node* to,
+												struct toml_node* from)
+{
+	struct toml_table_item *item, *next;
+
+	list_for_each_safe(&from->value.map, item, next, map) {
+		if (item->node.type == TOML_TABLE || item->node.type == TOML_TABLE_ARRAY)
+			continue;
+
+		if (toml_table_lookup(doc, to, item->node.name, item->node.name_len))
+			return 1;
+
+		list_del(&item->map);
+		if (toml_table_add(doc, to, item))
+			return 1;
+	}
+
+	return 0;
+}
+
+static int
+merge_segment(struct toml_document* doc, struct segment* seg)
+{
+	struct toml_document*	from = toml_document(seg->root);
+	struct toml_section*	section;
+	struct toml_node*		table;
+	char*					err = NULL;
+	size_t					i;
+	int						ret;
+
+	/* whatever is moved across must live as long as doc */
+	if (doc->arena)
+		toml_arena_adopt(doc->arena, from->arena);
+
+	/* only the first segment has keys ahead of its first header */
+	if (move_children(doc, &doc->root, seg->root))
+		return 1;
+
+	for (i = 0; i < seg->sections.count; i++) {
+		section = &seg->sections.v[i];
+
+		if (section->array)
+			ret = SawTableArray(&doc->root, section->name, section->name_len,
+																&table, &err);
+		else
+			ret = SawTable(&doc->root, section->name, section->name_len,
+																&table, &err);
+		if (ret) {
+			free(err);
+			return 1;
+		}
+
+		if (move_children(doc, table, section->table))
+			return 1;
+	}
+
+	return 0;
+}
+
+static bool
+limited(const struct toml_limits* limits)
+{
+	return limits->max_depth || limits->max_keys || limits->max_string ||
+								limits->max_nodes || limits->max_memory;
+}
+
+int
+toml_parse_parallel(struct toml_node* toml_root, char* buf, size_t len,
+											const struct toml_parse_opts* opts)
+{
+	struct toml_document*	doc = toml_document(toml_root);
+	struct segment*			segs = NULL;
+	pthread_t*				threads = NULL;
+	struct pool				pool;
+	size_t					max, count = 0, started = 0, i;
+	int						ret = 0;
+
+	/* limits are counted against the one document */
+	if (limited(&opts->limits))
+		goto sequential;
+
+	max = opts->threads * SEGMENTS_PER_THREAD;
+	if (max > len / MIN_SEGMENT)
+		max = len / MIN_SEGMENT;
+	if (max < 2)
+		goto sequential;
+
+	segs = calloc(max, sizeof(*segs));
+	threads = calloc(opts->threads - 1, sizeof(*threads));
+	if (!segs || !threads)
+		goto sequential;
+
+	count = find_segments(buf, len, len / max, segs, max);
+	if (count < 2)
+		goto sequential;
+
+	for (i = 0; i < count; i++) {
+		ret = doc->arena ? toml_init_arena(&segs[i].root) : toml_init(&segs[i].root);
+		if (ret || ((opts->flags & TOML_PARSE_BORROW) &&
+						toml_borrow(toml_document(segs[i].root), buf, len))) {
+			ret = 0;
+			goto sequential;
+		}
+	}
+
+	pool.segments = segs;
+	pool.count = count;
+	pool.next = 0;
+	pool.flags = opts->flags;
+	pthread_mutex_init(&pool.lock, NULL);
+
+	for (i = 0; i + 1 < opts->threads && i + 1 < count; i++) {
+		if (pthread_create(&threads[started], NULL, worker, &pool))
+			break;
+		started++;
+	}
+
+	worker(&pool);
+
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	pthread_mutex_destroy(&pool.lock);
+
+	/* a bad segment is parsed again in one go, for the proper error */
+	for (i = 0; i < count; i++) {
+		if (segs[i].ret)
+			goto sequential;
+	}
+
+	for (i = 0; i < count; i++) {
+		/* what was merged so far goes, and the plain parse says what is wrong */
+		if (merge_segment(doc, &segs[i])) {
+			toml_table_clear(doc, &doc->root, false);
+			goto sequential;
+		}
+	}
+
+	goto out;
+
+sequential:
+	ret = toml_parse_buffer(toml_root, buf, len, opts->flags);
+
+out:
+	for (i = 0; segs && i < count; i++) {
+		if (segs[i].root)
+			toml_free(segs[i].root);
+		free(segs[i].sections.v);
+	}
+	free(segs);
+	free(threads);
+
+	return ret;
+}
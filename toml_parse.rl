@@ -10,22 +10,130 @@
 #include <time.h>
 #include <math.h>
 #include <signal.h>
-#include <unicode/ustring.h>
+#include <errno.h>
 
 struct toml_stack_item {
 	struct list_node	list;
+	enum toml_type		type;
 	enum toml_type		list_type;
-	struct toml_node*	node;
+	struct toml_node*	node;		/* NULL when only reporting events */
 };
 
-#define PUSH_CONTEXT(x)	list_add_tail(&context_stack, &x->list);
+/*
+ * fcall only ever enters comment and str_escape, neither of which calls
+ * anything, so the machine's call stack is never more than one deep.
+ */
+#define CALL_DEPTH	2
+
+/*
+ * Everything the machine needs to carry on where it left off, so that input
+ * can be fed to it a chunk at a time.
+ */
+struct toml_parser {
+	struct toml_document*	doc;
+	const struct toml_events*	events;
+	void*					events_ctx;
+	int						abort;
+	int						cs, top, stack[CALL_DEPTH];
+	int						cur_line, indent, in_text;
+	struct list_head		context_stack;
+	const struct toml_limits*	limits;
+	unsigned int			depth;		/* lists and inline tables open */
+
+	char*					ts;
+	char*					string;		/* unescaped strings, reused */
+	size_t					string_len;
+	size_t					string_size;
+	char*					str_start;
+	int						str_trail;
+	char					escaped;
+	char*					utf_start;
+	uint32_t				utf16_high;	/* a surrogate waiting for its pair */
+	int						precision;
+	int						namelen;
+	int64_t					number;
+	bool					negative;
+	uint64_t				mantissa;	/* the first 19 significant digits */
+	int						digits;
+	int						exp10;		/* the number is mantissa * 10^exp10 */
+	bool					truncated;	/* non-zero digits beyond those */
+	bool					exponent;
+	bool					exp_negative;
+	int						exp_value;
+	int64_t					year;
+	int						month;
+	int						day;
+	int						hour;
+	int						minute;
+	int						second;
+	uint32_t				sec_frac;
+	int						sec_frac_digits;	/* up to nanoseconds */
+	int						time_offset;		/* minutes */
+	bool					time_offset_is_negative;
+	bool					time_offset_is_zulu;
+	char*					name;
+	size_t					name_len;
+
+	char*					parse_error;
+	int						malloc_error;
+	bool					failed;
+	bool					quiet;		/* leave error reports to the caller */
+	bool					check_utf8;
+	char					utf8[4];	/* a character split between chunks */
+	size_t					utf8_len;
+	struct toml_sections*	sections;	/* if set, log table headers here */
+
+	/*
+	 * The token being scanned starts at *token.  If it is still open at the
+	 * end of a chunk its bytes are kept in carry until it is complete.
+	 */
+	char**					token;
+	char*					carry;
+	size_t					carry_len;
+	size_t					carry_size;
+};
+
+#define OPEN_TOKEN(x)	(parser->token = &parser->x)
+#define CLOSE_TOKEN()	(parser->token = NULL)
+/* Jump over the rest of a clean run of string to the next byte of interest */
+#define SKIP_STRING(a, b)	\
+	(char*)toml_scan_string(p + 1, pe, (a), (b), &parser->cur_line)
+
+#define TWO_DIGITS(x)	(((x)[-1] - '0') * 10 + (x)[0] - '0')
+
+#define REPORT(...)	do {											\
+	if (!parser->quiet)												\
+		fprintf(stderr, __VA_ARGS__);								\
+} while (0)
+
+/* Report an event if there is a handler for it, false if it says to stop */
+#define EMIT(event, ...)	(!parser->events->event ||					\
+	!(parser->abort = parser->events->event(parser->events_ctx, ##__VA_ARGS__)))
+
+#define PUSH_CONTEXT(x)	list_add_tail(&parser->context_stack, &x->list);
 #define CONTEXT(x)		list_tail(x, struct toml_stack_item, list)
 #define POP_CONTEXT(x)	do { \
-	struct toml_stack_item* context = CONTEXT(&context_stack);	\
-	list_del(&context->list);									\
-	x = context->node;											\
+	struct toml_stack_item* context = CONTEXT(&parser->context_stack);	\
+	list_del(&context->list);											\
+	x = context->node;													\
+	free(context);														\
 } while (0)
 
+static struct toml_stack_item*
+make_stack_item(enum toml_type type, struct toml_node* node)
+{
+	struct toml_stack_item* ret;
+
+	ret = malloc(sizeof(*ret));
+	if (!ret)
+		return NULL;
+	ret->type = type;
+	ret->list_type = 0;
+	ret->node = node;
+
+	return ret;
+}
+
 static size_t
 utf32ToUTF8(char* dst, int len, uint32_t utf32)
 {
@@ -69,108 +177,369 @@ utf32ToUTF8(char* dst, int len, uint32_t utf32)
 	return 4;
 }
 
-static bool
-add_node_to_tree(struct list_head* context_stack, struct toml_node* node, char* name, char** parse_error, int* malloc_error, int cur_line)
+/* A \u escape of half a surrogate pair, or \U of something not unicode */
+static void
+bad_unicode(struct toml_parser* parser)
 {
-	struct toml_stack_item* context = CONTEXT(context_stack);
+	asprintf(&parser->parse_error, "bad unicode escape line %d\n", parser->cur_line);
+}
 
-	switch (context->node->type) {
-	case TOML_ROOT:
-	case TOML_TABLE:
-	case TOML_INLINE_TABLE: {
-		struct toml_table_item *item = malloc(sizeof(*item));
-		if (!item) {
-			*malloc_error = 1;
-			return false;
+/*
+ * Room for len more bytes at the end of the string being unescaped, NULL if
+ * it cannot grow.  The buffer doubles as needed and is kept for later strings.
+ * It counts against the memory limit of the document, and stops growing once
+ * the string is past the longest allowed: the exact length is checked when
+ * the string ends, as a utf escape reserves more than it may use.
+ */
+static char*
+str_reserve(struct toml_parser* parser, size_t len)
+{
+	size_t	size = parser->string_size ? parser->string_size : 256;
+	char*	string;
+
+	if (len > parser->string_size - parser->string_len) {
+		if (parser->limits->max_string &&
+				parser->string_len + len > parser->limits->max_string + 4) {
+			asprintf(&parser->parse_error, "string too long line %d\n", parser->cur_line);
+			return NULL;
 		}
-		memcpy(&item->node, node, sizeof(*node));
-		item->node.name = name;
-		list_add_tail(&context->node->value.map, &item->map);
-		break;
+
+		while (len > size - parser->string_len)
+			size *= 2;
+
+		if (parser->doc && !toml_charge(parser->doc, size - parser->string_size)) {
+			parser->malloc_error = 1;
+			return NULL;
+		}
+
+		string = realloc(parser->string, size);
+		if (!string) {
+			if (parser->doc)
+				toml_uncharge(parser->doc, size - parser->string_size);
+			parser->malloc_error = 1;
+			return NULL;
+		}
+		parser->string = string;
+		parser->string_size = size;
 	}
 
-	default:
+	return parser->string + parser->string_len;
+}
+
+static bool
+str_append(struct toml_parser* parser, const char* src, size_t len)
+{
+	char*	dst = str_reserve(parser, len);
+
+	if (!dst)
+		return false;
+
+	memcpy(dst, src, len);
+	parser->string_len += len;
+	return true;
+}
+
+/*
+ * Report a value, or hang it in the tree.  raw is the text of the value, or
+ * for a string its unescaped contents.
+ */
+static bool
+add_value(struct toml_parser* parser, struct toml_node* node, const char* raw, size_t len)
+{
+	struct toml_document*	doc = parser->doc;
+	struct toml_stack_item*	context = CONTEXT(&parser->context_stack);
+
+	if (context->type == TOML_LIST) {
 		if (context->list_type && context->list_type != node->type) {
-			asprintf(parse_error,
+			asprintf(&parser->parse_error,
 					"incompatible types list %s this %s line %d\n",
 					toml_type_to_str(context->list_type),
-					toml_type_to_str(node->type), cur_line);
+					toml_type_to_str(node->type), parser->cur_line);
 			return false;
 		}
 		context->list_type = node->type;
+	}
+
+	if (parser->events)
+		return EMIT(value, node->type, raw, len);
+
+	if (context->type == TOML_LIST) {
+		struct toml_list_item *item;
 
-		struct toml_list_item *item = malloc(sizeof(*item));
+		if (!toml_count_node(doc)) {
+			parser->malloc_error = 1;
+			return false;
+		}
+
+		item = toml_alloc(doc, sizeof(*item));
 		if (!item) {
-			*malloc_error = 1;
+			toml_uncount_node(doc);
+			parser->malloc_error = 1;
 			return false;
 		}
 
 		memcpy(&item->node, node, sizeof(*node));
 		item->node.name = NULL;
+		item->node.name_len = 0;
+		item->node.index = NULL;
+		list_add_tail(&context->node->value.list, &item->list);
+	} else {
+		struct toml_table_item *item = toml_alloc(doc, sizeof(*item));
+		if (!item) {
+			parser->malloc_error = 1;
+			return false;
+		}
+
+		memcpy(&item->node, node, sizeof(*node));
+		item->node.name = parser->name;
+		item->node.name_len = parser->name_len;
+		item->node.index = NULL;
+		if (toml_table_add(doc, context->node, item)) {
+			toml_release(doc, item);
+			parser->malloc_error = 1;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/*
+ * Add a table, inline table or list to the tree and make it the context that
+ * what follows goes into.
+ */
+static bool
+push_container(struct toml_parser* parser, enum toml_type type)
+{
+	struct toml_document*	doc = parser->doc;
+	struct toml_stack_item*	context = CONTEXT(&parser->context_stack);
+	struct toml_node*		node = NULL;
+
+	if (context->type == TOML_LIST) {
+		if (context->list_type && context->list_type != type) {
+			asprintf(&parser->parse_error,
+						"incompatible types list %s this %s line %d\n",
+						toml_type_to_str(context->list_type),
+						toml_type_to_str(type), parser->cur_line);
+			return false;
+		}
+		context->list_type = type;
+	}
+
+	if (parser->limits->max_depth && parser->depth == parser->limits->max_depth) {
+		asprintf(&parser->parse_error, "nested too deep line %d\n", parser->cur_line);
+		return false;
+	}
+
+	if (parser->events) {
+		if (type == TOML_LIST ? !EMIT(begin_array) : !EMIT(begin_inline_table))
+			return false;
+	} else if (context->type == TOML_LIST) {
+		struct toml_list_item *item;
+
+		if (!toml_count_node(doc)) {
+			parser->malloc_error = 1;
+			return false;
+		}
+
+		item = toml_alloc(doc, sizeof(*item));
+		if (!item) {
+			toml_uncount_node(doc);
+			parser->malloc_error = 1;
+			return false;
+		}
+
+		node = &item->node;
+		node->name = NULL;
+		node->name_len = 0;
 		list_add_tail(&context->node->value.list, &item->list);
-		break;
+	} else {
+		/* saw_key has already turned away duplicate names */
+		struct toml_table_item *item = toml_alloc(doc, sizeof(*item));
+		if (!item) {
+			parser->malloc_error = 1;
+			return false;
+		}
+
+		node = &item->node;
+		node->name = parser->name;
+		node->name_len = parser->name_len;
+		parser->name = NULL;
+		if (toml_table_add(doc, context->node, item)) {
+			toml_release(doc, item);
+			parser->malloc_error = 1;
+			return false;
+		}
 	}
 
+	if (node) {
+		node->type = type;
+		node->index = NULL;
+		if (type == TOML_LIST)
+			list_head_init(&node->value.list);
+		else
+			list_head_init(&node->value.map);
+	}
+
+	context = make_stack_item(type, node);
+	if (!context) {
+		parser->malloc_error = 1;
+		return false;
+	}
+	PUSH_CONTEXT(context);
+	parser->depth++;
+
+	return true;
+}
+
+/* The end of a list or inline table, back to whatever contains it */
+static bool
+pop_container(struct toml_parser* parser)
+{
+	struct toml_node*	x;
+	enum toml_type		type = CONTEXT(&parser->context_stack)->type;
+
+	POP_CONTEXT(x);
+	parser->depth--;
+
+	if (!parser->events)
+		return true;
+
+	return type == TOML_LIST ? EMIT(end_array) : EMIT(end_inline_table);
+}
+
+/* Start on a number, which is built up digit by digit as it is scanned */
+static void
+number_start(struct toml_parser* parser, bool negative)
+{
+	parser->negative = negative;
+	parser->mantissa = 0;
+	parser->digits = 0;
+	parser->exp10 = 0;
+	parser->truncated = false;
+	parser->precision = 0;
+	parser->exponent = false;
+	parser->exp_negative = false;
+	parser->exp_value = 0;
+}
+
+static void
+number_digit(struct toml_parser* parser, int digit, bool fraction)
+{
+	/* leading zeros only move the decimal point */
+	if (!parser->mantissa && !digit) {
+		parser->exp10 -= fraction;
+		return;
+	}
+
+	if (parser->digits < 19) {
+		parser->mantissa = parser->mantissa * 10 + digit;
+		parser->digits++;
+		parser->exp10 -= fraction;
+	} else {
+		parser->truncated |= digit != 0;
+		parser->exp10 += !fraction;
+	}
+}
+
+/* Note a table header and the table it opened */
+static bool
+log_section(struct toml_parser* parser, const char* name, size_t len,
+										bool array, struct toml_node* table)
+{
+	struct toml_sections*	log = parser->sections;
+	struct toml_section*	section;
+
+	if (log->count == log->size) {
+		size_t size = log->size ? log->size * 2 : 16;
+
+		section = realloc(log->v, size * sizeof(*section));
+		if (!section)
+			return false;
+
+		log->v = section;
+		log->size = size;
+	}
+
+	section = &log->v[log->count++];
+	section->name = name;
+	section->name_len = len;
+	section->line = parser->cur_line;
+	section->array = array;
+	section->table = table;
+
 	return true;
 }
 
 %%{
 	machine toml;
 
+	variable cs		parser->cs;
+	variable top	parser->top;
+	variable stack	parser->stack;
+
+	prepush { assert(parser->top < CALL_DEPTH); }
+
 	whitespace = [\t ]*;
 
-	name = (print - ('#'|'='|'"'|whitespace))+					>{ts = p;};
-	name_in_double_quotes = (print - '"')+						>{ts = p;};
-	name_in_single_quotes = (print - "'")+						>{ts = p;};
-	tablename =  (print - ('#'|']'|'['|'"'|whitespace))+		>{ts = p;};
-	tablename_in_double_quotes =  (print - '"')+				>{ts = p;};
-	tablename_in_single_quotes =  (print - "'")+				>{ts = p;};
+	name = (print - ('#'|'='|'"'|whitespace))+					>{parser->ts = p; OPEN_TOKEN(ts);};
+	name_in_double_quotes = (print - '"')+						>{parser->ts = p; OPEN_TOKEN(ts);};
+	name_in_single_quotes = (print - "'")+						>{parser->ts = p; OPEN_TOKEN(ts);};
+	tablename =  (print - ('#'|']'|'['|'"'|whitespace))+		>{parser->ts = p; OPEN_TOKEN(ts);};
+	tablename_in_double_quotes =  (print - '"')+				>{parser->ts = p; OPEN_TOKEN(ts);};
+	tablename_in_single_quotes =  (print - "'")+				>{parser->ts = p; OPEN_TOKEN(ts);};
 
 	action saw_key {
-		struct toml_table_item* item = NULL;
-		struct toml_stack_item* context = CONTEXT(&context_stack);
+		struct toml_stack_item* context = CONTEXT(&parser->context_stack);
 
-		switch (context->node->type) {
+		switch (context->type) {
 		case TOML_TABLE:
 		case TOML_ROOT:
 		case TOML_INLINE_TABLE:
 			break;
 
 		default:
-			asprintf(&parse_error, "context error key %.*s line %d\n", namelen + 1, ts, cur_line);
+			asprintf(&parser->parse_error, "context error key %.*s line %d\n", parser->namelen + 1, parser->ts, parser->cur_line);
 			fbreak;
 		}
 
-		list_for_each(&context->node->value.map, item, map) {
-			if (!item->node.name)
-				continue;
-			
-			if (strncmp(item->node.name, ts, namelen + 1) != 0)
-				continue;
-
-			asprintf(&parse_error, "duplicate key %s line %d\n", item->node.name, cur_line);
-			fbreak;
+		while (parser->ts[parser->namelen] == ' ' || parser->ts[parser->namelen] == '\t')
+			parser->namelen--;
+
+		parser->name_len = parser->namelen + 1;
+		CLOSE_TOKEN();
+
+		if (parser->events) {
+			if (!EMIT(key, parser->ts, parser->name_len))
+				fbreak;
+		} else {
+			if (toml_table_lookup(doc, context->node, parser->ts, parser->name_len)) {
+				asprintf(&parser->parse_error, "duplicate key %.*s line %d\n", parser->namelen + 1, parser->ts, parser->cur_line);
+				fbreak;
+			}
+
+			parser->name = toml_strview(doc, parser->ts, parser->name_len);
+			if (!parser->name) {
+				parser->malloc_error = 1;
+				fbreak;
+			}
 		}
-
-		while (ts[namelen] == ' ' || ts[namelen] == '\t')
-			namelen--;
-
-		name = strndup(ts, namelen + 1);
 	}
 
 	action saw_bool {
 		struct toml_node node;
 
 		node.type = TOML_BOOLEAN;
-		node.value.integer = number;
+		node.value.integer = parser->number;
 
-		if (!add_node_to_tree(&context_stack, &node, name, &parse_error, &malloc_error, cur_line))
+		if (!add_value(parser, &node, parser->number ? "true" : "false",
+												parser->number ? 4 : 5))
 			fbreak;
 
-		struct toml_stack_item *context = CONTEXT(&context_stack);
-		if (context->node->type == TOML_LIST)
+		struct toml_stack_item *context = CONTEXT(&parser->context_stack);
+		if (context->type == TOML_LIST)
 			fnext list;
-		else if (context->node->type == TOML_INLINE_TABLE)
+		else if (context->type == TOML_INLINE_TABLE)
 			fnext inline_table;
 		else
 			fnext start;
@@ -179,19 +548,26 @@ add_node_to_tree(struct list_head* context_stack, struct toml_node* node, char*
 	action saw_int {
 		char*					te = p;
 		struct toml_node		node;
-		struct toml_stack_item*	context = CONTEXT(&context_stack);
+		struct toml_stack_item*	context = CONTEXT(&parser->context_stack);
 
 		fhold;
+		CLOSE_TOKEN();
+
+		if (parser->exp10 || parser->mantissa > (uint64_t)INT64_MAX + parser->negative) {
+			asprintf(&parser->parse_error, "integer overflow\n");
+			fbreak;
+		}
 
 		node.type = TOML_INT;
-		node.value.integer = negative ? -number : number;
+		node.value.integer = parser->negative ?
+					(int64_t)(0 - parser->mantissa) : (int64_t)parser->mantissa;
 
-		if (!add_node_to_tree(&context_stack, &node, name, &parse_error, &malloc_error, cur_line))
+		if (!add_value(parser, &node, parser->ts, te - parser->ts))
 			fbreak;
 
-		if (context->node->type == TOML_LIST)
+		if (context->type == TOML_LIST)
 			fnext list;
-		else if (context->node->type == TOML_INLINE_TABLE)
+		else if (context->type == TOML_INLINE_TABLE)
 			fnext inline_table;
 		else
 			fnext start;
@@ -202,281 +578,324 @@ add_node_to_tree(struct list_head* context_stack, struct toml_node* node, char*
 		struct toml_node	node;
 
 		fhold;
+		CLOSE_TOKEN();
 
-		floating = strtod(ts, &te);
-
-		node.type = TOML_FLOAT;
-		node.value.floating.value = floating;
-		node.value.floating.precision = precision;
-
-		if (!node.value.floating.precision && !exponent) {
-			asprintf(&parse_error, "bad float\n");
+		if (!parser->precision && !parser->exponent) {
+			asprintf(&parser->parse_error, "bad float\n");
 			fbreak;
 		}
 
-		exponent = false;
+		node.type = TOML_FLOAT;
+		if (!parser->events) {
+			int exp10 = parser->exp10 +
+				(parser->exp_negative ? -parser->exp_value : parser->exp_value);
+
+			if (!toml_decimal_to_double(parser->mantissa, exp10, parser->negative,
+							parser->truncated, &node.value.floating.value))
+				node.value.floating.value = toml_strtod(parser->ts, te - parser->ts);
+			node.value.floating.precision = parser->precision;
+		}
 
-		if (!add_node_to_tree(&context_stack, &node, name, &parse_error, &malloc_error, cur_line))
+		if (!add_value(parser, &node, parser->ts, te - parser->ts))
 			fbreak;
 
-		struct toml_stack_item *context = CONTEXT(&context_stack);
-		if (context->node->type == TOML_LIST)
+		struct toml_stack_item *context = CONTEXT(&parser->context_stack);
+		if (context->type == TOML_LIST)
 			fnext list;
-		else if (context->node->type == TOML_INLINE_TABLE)
+		else if (context->type == TOML_INLINE_TABLE)
 			fnext inline_table;
 		else
 			fnext start;
 	}
 
 	action saw_string {
-		int					len = strp - string + 1;
+		char*				str = parser->str_start;
+		size_t				len = p - parser->str_trail - parser->str_start;
 		struct toml_node	node;
 
-		*strp = 0;
-
 		node.type = TOML_STRING;
-		node.value.string = malloc(len);
-		if (!node.value.string) {
-			malloc_error = 1;
+		CLOSE_TOKEN();
+
+		if (parser->utf16_high) {
+			bad_unicode(parser);
 			fbreak;
 		}
-		memcpy(node.value.string, string, len);
 
-		if (!add_node_to_tree(&context_stack, &node, name, &parse_error, &malloc_error, cur_line))
+		/* unless nothing was unescaped the value is put together in string */
+		if (parser->string_len) {
+			if (!str_append(parser, str, len))
+				fbreak;
+			str = parser->string;
+			len = parser->string_len;
+		}
+
+		if (parser->limits->max_string && len > parser->limits->max_string) {
+			asprintf(&parser->parse_error, "string too long line %d\n", parser->cur_line);
+			fbreak;
+		}
+
+		if (!parser->events) {
+			node.value.string = toml_strview(doc, str, len);
+			node.value.string_len = len;
+			if (!node.value.string) {
+				parser->malloc_error = 1;
+				fbreak;
+			}
+		}
+
+		if (!add_value(parser, &node, str, len))
 			fbreak;
 
-		struct toml_stack_item *context = CONTEXT(&context_stack);
-		if (context->node->type == TOML_LIST)
+		struct toml_stack_item *context = CONTEXT(&parser->context_stack);
+		if (context->type == TOML_LIST)
 			fnext list;
-		else if (context->node->type == TOML_INLINE_TABLE)
+		else if (context->type == TOML_INLINE_TABLE)
 			fnext inline_table;
 		else
 			fnext start;
 	}
 
+	# an escape sequence ends the current span, it is copied out and the
+	# unescaped character follows it
+	action str_flush {
+		if (parser->utf16_high && p != parser->str_start) {
+			bad_unicode(parser);
+			fbreak;
+		}
+		if (!str_append(parser, parser->str_start, p - parser->str_start))
+			fbreak;
+		parser->str_start = p;
+	}
+
+	action saw_escape {
+		if (parser->utf16_high) {
+			bad_unicode(parser);
+			fbreak;
+		}
+		if (!str_append(parser, &parser->escaped, 1))
+			fbreak;
+		parser->str_start = p + 1;
+		fret;
+	}
+
 	action saw_date {
-		char*	te = p;
 		struct	toml_node node;
+		int		offset = parser->time_offset_is_negative ? -parser->time_offset :
+														parser->time_offset;
 
 		node.type = TOML_DATE;
-		node.value.rfc3339_time.epoch = timegm(&tm);
-		node.value.rfc3339_time.offset_sign_negative = time_offset_is_negative;
-		node.value.rfc3339_time.offset = time_offset;
-		node.value.rfc3339_time.offset_is_zulu = time_offset_is_zulu;
-		if (secfrac_ptr)
-			node.value.rfc3339_time.sec_frac = strtol(secfrac_ptr, &te, 10);
-		else
-			node.value.rfc3339_time.sec_frac = -1;
-
-		if (!add_node_to_tree(&context_stack, &node, name, &parse_error, &malloc_error, cur_line))
+		if (!toml_epoch(parser->year, parser->month, parser->day, parser->hour,
+					parser->minute, parser->second, offset,
+					&node.value.rfc3339_time.epoch)) {
+			asprintf(&parser->parse_error, "invalid date line %d\n", parser->cur_line);
+			fbreak;
+		}
+		node.value.rfc3339_time.sec_frac = parser->sec_frac;
+		node.value.rfc3339_time.sec_frac_digits = parser->sec_frac_digits;
+		node.value.rfc3339_time.offset = offset;
+		node.value.rfc3339_time.offset_sign_negative = parser->time_offset_is_negative;
+		node.value.rfc3339_time.offset_is_zulu = parser->time_offset_is_zulu;
+		CLOSE_TOKEN();
+
+		if (!add_value(parser, &node, parser->ts, p + 1 - parser->ts))
 			fbreak;
 
-		struct toml_stack_item *context = CONTEXT(&context_stack);
-		if (context->node->type == TOML_LIST)
+		struct toml_stack_item *context = CONTEXT(&parser->context_stack);
+		if (context->type == TOML_LIST)
 			fnext list;
-		else if (context->node->type == TOML_INLINE_TABLE)
+		else if (context->type == TOML_INLINE_TABLE)
 			fnext inline_table;
 		else
 			fnext start;
 	}
 
 	action start_list {
-		struct toml_node *node;
-
-		struct toml_stack_item* context = CONTEXT(&context_stack);
-
-		if (context->list_type && context->list_type != TOML_LIST) {
-			asprintf(&parse_error,
-						"incompatible types list %s this %s line %d\n",
-						toml_type_to_str(context->list_type),
-						toml_type_to_str(TOML_BOOLEAN), cur_line);
+		if (!push_container(parser, TOML_LIST))
 			fbreak;
-		}
-
-		struct toml_list_item *item = malloc(sizeof(*item));
-		if (!item) {
-			malloc_error = 1;
-			fbreak;
-		}
-
-		context->list_type = TOML_LIST;
-		item->node.type = TOML_LIST;
-		if (name)
-		{
-			item->node.name = name;
-			name = NULL;
-		}
-		list_head_init(&item->node.value.list);
-
-		list_add_tail(&context->node->value.list, &item->list);
-		node = &item->node;
-
-		/* push this list onto the stack */
-		struct toml_stack_item *stack_item = make_stack_item(node);
-		PUSH_CONTEXT(stack_item);
 	}
 
 	action end_list {
-		struct toml_node* x;
-		POP_CONTEXT(x);
+		if (!pop_container(parser))
+			fbreak;
 
-		struct toml_stack_item *context = CONTEXT(&context_stack);
-		if (context->node->type == TOML_LIST)
+		struct toml_stack_item *context = CONTEXT(&parser->context_stack);
+		if (context->type == TOML_LIST)
 			fnext list;
-		else if (context->node->type == TOML_INLINE_TABLE)
+		else if (context->type == TOML_INLINE_TABLE)
 			fnext inline_table;
 		else
 			fnext start;
 	}
 
 	action saw_inline_table {
-		char*					tablename = name;
-		struct toml_table_item*	item;
-		struct toml_node*		place;
-		bool					found = false;
-
-		struct toml_stack_item*	context = CONTEXT(&context_stack);
-		place = context->node;
-
-		list_for_each(&place->value.map, item, map) {
-			if (strcmp(item->node.name, tablename) != 0)
-				continue;
-
-			found = true;
-			break;
-		}
-
-		if (found)
-		{
-			asprintf(&parse_error, "duplicate entry %s\n", tablename);
-			fbreak;
-		}
-
-		item = malloc(sizeof(*item));
-		if (!item) {
-			malloc_error = 1;
+		if (!push_container(parser, TOML_INLINE_TABLE))
 			fbreak;
-		}
-
-		item->node.name = strdup(tablename);
-		item->node.type = TOML_INLINE_TABLE;
-		list_head_init(&item->node.value.map);
-		list_add_tail(&place->value.map, &item->map);
-
-		context = make_stack_item(&item->node);
-		PUSH_CONTEXT(context);
-
-		free(tablename);
 	}
 
 	action end_inline_table {
-		struct toml_node* x;
-		POP_CONTEXT(x);
+		if (!pop_container(parser))
+			fbreak;
 
-		struct toml_stack_item *context = CONTEXT(&context_stack);
-		if (context->node->type == TOML_LIST)
+		struct toml_stack_item *context = CONTEXT(&parser->context_stack);
+		if (context->type == TOML_LIST)
 			fnext list;
-		else if (context->node->type == TOML_INLINE_TABLE)
+		else if (context->type == TOML_INLINE_TABLE)
 			fnext inline_table;
 		else
 			fnext start;
 	}
 
 	action saw_table {
-		int len = (int)(p-ts);
+		int len = (int)(p-parser->ts);
 
 		// drop the previous context if it is a TABLE
-		struct toml_stack_item* context = CONTEXT(&context_stack);
-		if (context->node->type == TOML_TABLE)
+		struct toml_stack_item* context = CONTEXT(&parser->context_stack);
+		if (context->type == TOML_TABLE)
 		{
 			struct toml_node* x;
 			POP_CONTEXT(x);
 		}
 
-		struct toml_node *new_table;
+		struct toml_node *new_table = NULL;
 
 		int		result;
-		char*	name = strndup(ts, len);
 
-		result = SawTable(toml_root, name, &new_table, &parse_error);
-		free(name);
-		if (result)
-			fbreak;
+		CLOSE_TOKEN();
+
+		if (parser->events) {
+			if (!EMIT(begin_table, parser->ts, len))
+				fbreak;
+		} else {
+			result = SawTable(toml_root, parser->ts, len, &new_table, &parser->parse_error);
+			if (result) {
+				parser->malloc_error = result == ENOMEM || result == E2BIG;
+				fbreak;
+			}
+
+			if (parser->sections &&
+					!log_section(parser, parser->ts, len, false, new_table)) {
+				parser->malloc_error = 1;
+				fbreak;
+			}
+		}
 
-		context = make_stack_item(new_table);
+		context = make_stack_item(TOML_TABLE, new_table);
+		if (!context) {
+			parser->malloc_error = 1;
+			fbreak;
+		}
 		PUSH_CONTEXT(context);
 	}
 
 	action saw_table_array {
 		int		ret;
-		char*	tableName;
+		int		len = (int)(p-parser->ts-1);
 
 		// drop the previous context if it is a TABLE
-		struct toml_stack_item* context = CONTEXT(&context_stack);
-		if (context->node->type == TOML_TABLE)
+		struct toml_stack_item* context = CONTEXT(&parser->context_stack);
+		if (context->type == TOML_TABLE)
 		{
 			struct toml_node* x;
 			POP_CONTEXT(x);
 		}
 
-		struct toml_node* new_table_array;
+		struct toml_node* new_table_array = NULL;
+
+		CLOSE_TOKEN();
+
+		if (parser->events) {
+			if (!EMIT(begin_table_array, parser->ts, len))
+				fbreak;
+		} else {
+			ret = SawTableArray(toml_root, parser->ts, len, &new_table_array, &parser->parse_error);
+			if (ret) {
+				parser->malloc_error = ret == ENOMEM;
+				fbreak;
+			}
+
+			if (parser->sections &&
+					!log_section(parser, parser->ts, len, true, new_table_array)) {
+				parser->malloc_error = 1;
+				fbreak;
+			}
+		}
 
-		tableName = strndup(ts, (int)(p-ts-1));
-		ret = SawTableArray(toml_root, tableName, &new_table_array, &parse_error);
-		free(tableName);
-		if (ret)
+		context = make_stack_item(TOML_TABLE, new_table_array);
+		if (!context) {
+			parser->malloc_error = 1;
 			fbreak;
-
-		context = make_stack_item(new_table_array);
+		}
 		PUSH_CONTEXT(context);
 	}
 
+	# a surrogate pair must be two escapes in a row
 	action saw_utf16 {
-		UChar		utf16[2] = { 0 };
-		int32_t		len = sizeof(string) - (strp - string);
-		int32_t		outLen;
-		UErrorCode	err = U_ZERO_ERROR;
+		uint32_t	utf16;
+		char*		dst = str_reserve(parser, 4);
 		char		utf16_str[5] = { 0 };
 
-		memcpy(utf16_str, utf_start, 4);
-		*utf16 = strtoul(utf16_str, NULL, 16);
+		if (!dst)
+			fbreak;
+
+		memcpy(utf16_str, parser->utf_start, 4);
+		utf16 = strtoul(utf16_str, NULL, 16);
 
-		u_strToUTF8(strp, len, &outLen, utf16, 1, &err);
-		strp += outLen;
+		if (parser->utf16_high && utf16 >= 0xdc00 && utf16 < 0xe000) {
+			utf16 = 0x10000 + ((parser->utf16_high - 0xd800) << 10) + utf16 - 0xdc00;
+			parser->utf16_high = 0;
+		} else if (parser->utf16_high || (utf16 >= 0xdc00 && utf16 < 0xe000)) {
+			bad_unicode(parser);
+			fbreak;
+		} else if (utf16 >= 0xd800 && utf16 < 0xdc00) {
+			parser->utf16_high = utf16;
+			parser->str_start = p + 1;
+			fret;
+		}
+
+		parser->string_len += utf32ToUTF8(dst, 4, utf16);
+		parser->str_start = p + 1;
 		fret;
 	}
 
 	action saw_utf32 {
 		uint32_t	utf32;
-		int32_t		len = sizeof(string) - (strp - string);
-		int32_t		outLen;
+		char*		dst = str_reserve(parser, 4);
 		char		utf32_str[9] = { 0 };
 
-		memcpy(utf32_str, utf_start, 8);
+		if (!dst)
+			fbreak;
+
+		memcpy(utf32_str, parser->utf_start, 8);
 		utf32 = strtoul(utf32_str, NULL, 16);
 
-		outLen = utf32ToUTF8(strp, len, utf32);
-		strp += outLen;
+		if (parser->utf16_high || utf32 > 0x10ffff ||
+									(utf32 >= 0xd800 && utf32 < 0xe000)) {
+			bad_unicode(parser);
+			fbreak;
+		}
+
+		parser->string_len += utf32ToUTF8(dst, 4, utf32);
+		parser->str_start = p + 1;
 		fret;
 	}
 
 	action bad_escape {
-		asprintf(&parse_error, "bad escape \\%c", *p);
+		asprintf(&parser->parse_error, "bad escape \\%c", *p);
 		fbreak;
 	}
 
 	lines = (
 		start: (
 			# count the indentation to know where the tables end
-			'#'			>{in_text = 0; fcall comment;}				->start			|
-			[\t ]+		>{in_text = 0; indent = 0;} ${indent++;}	@{fgoto start;}	|
-			[\n]		>{in_text = 0; cur_line++;}					@{fgoto start;}	|
-			[\0]		>{in_text = 0; fbreak;}						@{fgoto start;}	|
-			[^#\t \n\0]	@{fhold;} %{in_text = 1;}					->text
+			'#'			>{parser->in_text = 0; fcall comment;}				->start			|
+			[\t ]+		>{parser->in_text = 0; parser->indent = 0;} ${parser->indent++;}	@{fgoto start;}	|
+			[\n]		>{parser->in_text = 0; parser->cur_line++;}					@{fgoto start;}	|
+			[\0]		>{parser->in_text = 0; fbreak;}						@{fgoto start;}	|
+			[^#\t \n\0]	@{fhold;} %{parser->in_text = 1;}					->text
 		),
 
 		# just discard everything until newline
-		comment: ( [^\n]*[\n] ${cur_line++; fret;} ),
+		comment: ( [^\n]*[\n] ${parser->cur_line++; fret;} ),
 
 		# a table
 		table: (
@@ -492,184 +911,208 @@ add_node_to_tree(struct list_head* context_stack, struct toml_node* node, char*
 		true:	( any	>{fhold;} $saw_bool	->start ),
 		false:	( any	>{fhold;} $saw_bool	->start ),
 
+		# Strings are tracked as spans of the input starting at str_start.  The
+		# span only has to be copied into string when an escape interrupts it.
 		basic_string: (
-			["]				-> basic_empty_or_multi_line	|
-			[^"] ${fhold;}	-> basic_string_contents
+			["]		${parser->str_trail = 1;}	-> basic_empty_or_multi_line	|
+			[^"]	${fhold;}			-> basic_string_contents
 		),
 
 		basic_empty_or_multi_line: (
-			["]							-> basic_multi_line_start	|
-			[^"] $saw_string ${fhold;}	-> start
+			["]		${parser->str_trail = 2;}		-> basic_multi_line_start	|
+			[^"]	$saw_string ${fhold;}	-> start
 		),
 
 		basic_multi_line_start: (
-			'\n' ${cur_line++;}	-> basic_multi_line	|
-			[^\n] ${fhold;}		-> basic_multi_line
+			'\n'	${parser->cur_line++; parser->str_start = p + 1;}	-> basic_multi_line	|
+			[^\n]	${parser->str_start = p; fhold;}			-> basic_multi_line
 		),
 
 		basic_multi_line: (
-			["]										-> basic_multi_line_quote	|
-			[\n]		${cur_line++;*strp++=fc;}	@{fgoto basic_multi_line;}	|
-			[\\]									-> basic_multi_line_escape	|
-			[^"\n\\]	${*strp++=fc;}				@{fgoto basic_multi_line;}
+			["]								-> basic_multi_line_quote	|
+			[\n]		${parser->cur_line++;}		@{fgoto basic_multi_line;}	|
+			[\\]		$str_flush			-> basic_multi_line_escape	|
+			[^"\n\\]						@{fexec SKIP_STRING('"', '\\'); fgoto basic_multi_line;}
 		),
 
 		basic_multi_line_escape: (
-			[\n]	${cur_line++;}			-> basic_multi_line_rm_ws	|
-			[^\n]	${fcall str_escape;}	-> basic_multi_line
+			[\n]	${parser->cur_line++;}					-> basic_multi_line_rm_ws	|
+			[^\n]	${fhold; fcall str_escape;}		-> basic_multi_line
 		),
 
 		basic_multi_line_rm_ws: (
-			[\n]	${cur_line++;}	@{fgoto basic_multi_line_rm_ws;}	|
-			[ \t]					@{fgoto basic_multi_line_rm_ws;}	|
-			[^ \t\n]	${fhold;}	-> basic_multi_line
+			[\n]	${parser->cur_line++;}				@{fgoto basic_multi_line_rm_ws;}	|
+			[ \t]								@{fgoto basic_multi_line_rm_ws;}	|
+			[^ \t\n]	${parser->str_start = p; fhold;}	-> basic_multi_line
 		),
 
 		basic_multi_line_quote: (
-			["]								-> basic_multi_line_quote_2	|
-			[^"]	${fhold;*strp++='"';}	-> basic_multi_line
+			["]				-> basic_multi_line_quote_2	|
+			[^"] ${fhold;}	-> basic_multi_line
 		),
 
 		basic_multi_line_quote_2: (
-			["]		$saw_string							-> start |
-			[^"]	${fhold;*strp++='"';*strp++='"';}	-> basic_multi_line
+			["]		$saw_string	-> start |
+			[^"]	${fhold;}	-> basic_multi_line
 		),
 
 		# String, we have to escape \0, \t, \n, \r, everything else can
 		# be prefixed with a slash and the slash just gets dropped
 		basic_string_contents: (
-			'"'			$saw_string					-> start						|
-			[\n]		${cur_line++; *strp++=fc;}	@{fgoto basic_string_contents;}	|
-			[\\]		${fcall str_escape;}		-> basic_string_contents		|
-			[^"\n\\]	${*strp++=fc;}				@{fgoto basic_string_contents;}
+			'"'			$saw_string						-> start						|
+			[\n]		${parser->cur_line++;}					@{fgoto basic_string_contents;}	|
+			[\\]		$str_flush ${fcall str_escape;}	-> basic_string_contents		|
+			[^"\n\\]			@{fexec SKIP_STRING('"', '\\'); fgoto basic_string_contents;}
 		),
 
 		str_escape: (
-			'b'	${*strp++=0x8;}			${fret;}	|
-			't'	${*strp++='\t';}		${fret;}	|
-			'n'	${*strp++='\n';}		${fret;}	|
-			'f'	${*strp++=0xc;}			${fret;}	|
-			'r'	${*strp++='\r';}		${fret;}	|
-			'0'	${*strp++=0;}			${fret;}	|
-			'"'	${*strp++='"';}			${fret;}	|
-			'/'	${*strp++='/';}			${fret;}	|
-			'\\'	${*strp++='\\';}	${fret;}	|
+			'b'		${parser->escaped = 0x8;}	$saw_escape	|
+			't'		${parser->escaped = '\t';}	$saw_escape	|
+			'n'		${parser->escaped = '\n';}	$saw_escape	|
+			'f'		${parser->escaped = 0xc;}	$saw_escape	|
+			'r'		${parser->escaped = '\r';}	$saw_escape	|
+			'0'		${parser->escaped = 0;}		$saw_escape	|
+			'"'		${parser->escaped = '"';}	$saw_escape	|
+			'/'		${parser->escaped = '/';}	$saw_escape	|
+			'\\'	${parser->escaped = '\\';}	$saw_escape	|
 			'u'							-> unicode4	|
 			'U'							-> unicode8	|
 			[^btnfr0uU"/\\] $bad_escape
 		),
 
 		unicode4: (
-			xdigit{4} >{utf_start=p;} @saw_utf16
+			xdigit{4} >{parser->utf_start=p;} @saw_utf16
 		),
 
 		unicode8: (
-			xdigit{8} >{utf_start=p;} @saw_utf32
+			xdigit{8} >{parser->utf_start=p;} @saw_utf32
 		),
 
 		# When we don't know yet if this is going to be a date or a number
 		# this is the state
 		number_or_date: (
-			'_' ? digit ${number *= 10; number += fc-'0';}	@{fgoto number_or_date;}	|
-			'-'	${tm.tm_year = number - 1900;}				->date						|
-			[eE]											->exponent_part				|
-			[.]	>{precision = 0;}							->fractional_part			|
+			'_' ? digit ${number_digit(parser, fc - '0', false);}	@{fgoto number_or_date;}	|
+			'-'	${parser->year = parser->mantissa;}				->date						|
+			[eE]	${parser->exponent = true;}						->exponent_sign				|
+			[.]												->fractional_part			|
 			[\t ,}\]\n\0] $saw_int							->start
 		),
 
 		# Fractional part of a double
 		fractional_part: (
-			[0-9]	${precision++;}		@{fgoto fractional_part;}	|
-			[eE]						->exponent_part				|
-			[^0-9eE]	$saw_float 		->start
+			'_' ? digit	${parser->precision++; number_digit(parser, fc - '0', true);}	@{fgoto fractional_part;}	|
+			[eE]	${parser->exponent = true;}		->exponent_sign				|
+			[^0-9eE_]	$saw_float 		->start
+		),
+
+		exponent_sign: (
+			'-'		${parser->exp_negative = true;}	->exponent_first	|
+			'+'										->exponent_first	|
+			digit	${fhold;}						->exponent_first
+		),
+
+		exponent_first: (
+			digit	${fhold;}	->exponent_part
 		),
 
+		# big enough exponents are all the same, infinity or zero
 		exponent_part: (
-			[\-\+0-9]	${exponent=true;}	@{fgoto exponent_part;}	|
-			[^\-\+0-9]	$saw_float 			->start
+			'_' ? digit	${if (parser->exp_value < 100000) parser->exp_value = parser->exp_value * 10 + fc - '0';}	@{fgoto exponent_part;}	|
+			[^0-9_]	$saw_float 			->start
 		),
 
 		# Zulu date, we've already picked up the first four digits and the '-'
 		# when figuring this was a date and not a number
-		date: ( '' >{secfrac_ptr = NULL; time_offset = 0; time_offset_is_negative = 0; time_offset_is_zulu = 0;}
-			digit{2} @{tm.tm_mon = atoi(fpc-1) - 1;}
+		date: ( '' >{parser->sec_frac = 0; parser->sec_frac_digits = 0; parser->time_offset = 0; parser->time_offset_is_negative = 0; parser->time_offset_is_zulu = 0;}
+			digit{2} @{parser->month = TWO_DIGITS(fpc);}
 			'-'
-			digit{2} @{tm.tm_mday = atoi(fpc-1);}
+			digit{2} @{parser->day = TWO_DIGITS(fpc);}
 			'T'
-			digit{2} @{tm.tm_hour = atoi(fpc-1);}
+			digit{2} @{parser->hour = TWO_DIGITS(fpc);}
 			':'
-			digit{2} @{tm.tm_min = atoi(fpc-1);}
+			digit{2} @{parser->minute = TWO_DIGITS(fpc);}
 			':'
-			digit{2} @{tm.tm_sec = atoi(fpc-1);} -> fractional_second_or_offset
+			digit{2} @{parser->second = TWO_DIGITS(fpc);} -> fractional_second_or_offset
 		),
 
 		fractional_second_or_offset: (
-			'.' digit* >{secfrac_ptr=p;} >{fhold;}	-> time_offset	|
-			[^.] @{fhold;}							-> time_offset
+			'.'							-> fractional_second	|
+			[^.] @{fhold;}				-> time_offset
+		),
+
+		# digits past nanoseconds are dropped
+		fractional_second: (
+			digit ${if (parser->sec_frac_digits < 9) { parser->sec_frac = parser->sec_frac * 10 + fc - '0'; parser->sec_frac_digits++;}}	@{fgoto fractional_second_more;}
+		),
+
+		fractional_second_more: (
+			digit ${if (parser->sec_frac_digits < 9) { parser->sec_frac = parser->sec_frac * 10 + fc - '0'; parser->sec_frac_digits++;}}	@{fgoto fractional_second_more;}	|
+			[^0-9] @{fhold;}			-> time_offset
 		),
 
 		time_offset: (
-			('-' @{time_offset_is_negative=1;}|'+')
-				digit{2} @{time_offset = atoi(fpc-1) * 60;}
+			('-' @{parser->time_offset_is_negative=1;}|'+')
+				digit{2} @{parser->time_offset = TWO_DIGITS(fpc) * 60;}
 				':'
-				digit{2} @{time_offset += atoi(fpc-1);}
+				digit{2} @{parser->time_offset += TWO_DIGITS(fpc);}
 				@saw_date								-> start |
-			'Z' >{time_offset_is_zulu = 1;} @saw_date	-> start
+			'Z' >{parser->time_offset_is_zulu = 1;} @saw_date	-> start
 		),
 
 		literal_string: (
-			[']					-> literal_empty_or_multi_line		|
-			[^']	${fhold;}	-> literal_string_contents
+			[']		${parser->str_trail = 1;}	-> literal_empty_or_multi_line	|
+			[^']	${fhold;}			-> literal_string_contents
 		),
 
 		literal_string_contents: (
 			[']		$saw_string		->start	|
-			[^']	${*strp++=fc;}	@{fgoto literal_string_contents;}
+			[\n]	${parser->cur_line++;}	@{fgoto literal_string_contents;}	|
+			[^'\n]	@{fexec SKIP_STRING('\'', '\''); fgoto literal_string_contents;}
 		),
 
 		literal_empty_or_multi_line: (
-			[']								-> literal_multi_line_start	|
-			[^']	${fhold;} $saw_string	-> start
+			[']		${parser->str_trail = 2;}		-> literal_multi_line_start	|
+			[^']	$saw_string ${fhold;}	-> start
 		),
 
 		literal_multi_line_start: (
-			'\n' ${cur_line++;}	-> literal_multi_line	|
-			[^\n] ${fhold;}		-> literal_multi_line
+			'\n'	${parser->cur_line++; parser->str_start = p + 1;}	-> literal_multi_line	|
+			[^\n]	${parser->str_start = p; fhold;}			-> literal_multi_line
 		),
 
 		literal_multi_line: (
-			[']									-> literal_multi_line_quote		|
-			[\n]	${cur_line++;*strp++=fc;}	@{fgoto literal_multi_line;}	|
-			[^'\n]	${*strp++=fc;}				@{fgoto literal_multi_line;}
+			[']							-> literal_multi_line_quote		|
+			[\n]	${parser->cur_line++;}		@{fgoto literal_multi_line;}	|
+			[^'\n]	@{fexec SKIP_STRING('\'', '\''); fgoto literal_multi_line;}
 		),
 
 		# saw 1 quote, if there's not another one go back to literalMultiLine
 		literal_multi_line_quote: (
-			[']									-> literal_multi_line_second_quote |
-			[^']	${fhold;*strp++='\'';}		-> literal_multi_line
+			[']					-> literal_multi_line_second_quote |
+			[^']	${fhold;}	-> literal_multi_line
 		),
 
 		# saw 2 quotes, if there's not another one go back to literalMultiLine
 		# if there is another then terminate the string
 		literal_multi_line_second_quote: (
-			[']		$saw_string							-> start				|
-			[^']	${fhold;*strp++='\'';*strp++='\'';}	-> literal_multi_line
+			[']		$saw_string		-> start				|
+			[^']	${fhold;}		-> literal_multi_line
 		),
 
 		# Non-list value
 		singular: (
-			'true'		@{number = 1;}									-> true				|
-			'false'		@{number = 0;}									-> false			|
-			'"'			${strp = string;}								-> basic_string		|
-			[']			${strp = string;}								-> literal_string	|
-			('-'|'+')	${negative = fc == '-'; number = 0; ts = p;}	-> number_or_date	|
-			digit		${negative = false; ts = p; number = fc-'0';}	-> number_or_date
+			'true'		@{parser->number = 1;}									-> true				|
+			'false'		@{parser->number = 0;}									-> false			|
+			'"'			${parser->string_len = 0; parser->str_start = p + 1; parser->str_trail = 0; OPEN_TOKEN(str_start);}-> basic_string		|
+			[']			${parser->string_len = 0; parser->str_start = p + 1; parser->str_trail = 0; OPEN_TOKEN(str_start);}-> literal_string	|
+			('-'|'+')	${number_start(parser, fc == '-'); parser->ts = p; OPEN_TOKEN(ts);}	-> number_or_date	|
+			digit		${number_start(parser, false); number_digit(parser, fc - '0', false); parser->ts = p; OPEN_TOKEN(ts);}	-> number_or_date
 		),
 
 		# A list of values
 		list: (
 			'#'		>{fcall comment;}	->list			|
-			'\n'	${cur_line++;}		@{fgoto list;}	|
+			'\n'	${parser->cur_line++;}		@{fgoto list;}	|
 			[\t ]						@{fgoto list;}	|
 			','							@{fgoto list;}	|
 			']'	$end_list				->start			|
@@ -687,7 +1130,7 @@ add_node_to_tree(struct list_head* context_stack, struct toml_node* node, char*
 		# A val can be either a list or a singular value
 		val: (
 			'#'				>{fcall comment;}	->val				|
-			'\n'+			${ cur_line++; }	@{fgoto val;}		|
+			'\n'+			${ parser->cur_line++; }	@{fgoto val;}		|
 			[\t ]								@{fgoto val;}		|
 			'['				$start_list			->list				|
 			'{'				$saw_inline_table	->inline_table		|
@@ -696,9 +1139,9 @@ add_node_to_tree(struct list_head* context_stack, struct toml_node* node, char*
 
 		# A regular key
 		key: (
-			name @{namelen = (int)(p-ts);} whitespace '=' $saw_key								->val	|
-			'"' name_in_double_quotes '"' @{namelen = (int)(p-ts-1);} whitespace '=' $saw_key	->val	|
-			"'" name_in_single_quotes "'" @{namelen = (int)(p-ts-1);} whitespace '=' $saw_key	->val
+			name @{parser->namelen = (int)(p-parser->ts);} whitespace '=' $saw_key								->val	|
+			'"' name_in_double_quotes '"' @{parser->namelen = (int)(p-parser->ts-1);} whitespace '=' $saw_key	->val	|
+			"'" name_in_single_quotes "'" @{parser->namelen = (int)(p-parser->ts-1);} whitespace '=' $saw_key	->val
 		),
 
 		# Text stripped of leading whitespace
@@ -706,7 +1149,7 @@ add_node_to_tree(struct list_head* context_stack, struct toml_node* node, char*
 			'#'	>{fcall comment;}	->text			|
 			'['						->table			|
 			[\t ]					@{fgoto text;}	|
-			'\n' ${cur_line++;}		->start			|
+			'\n' ${parser->cur_line++;}		->start			|
 			[^#[\t \n]	${fhold;}	->key
 		)
 	);
@@ -716,85 +1159,492 @@ add_node_to_tree(struct list_head* context_stack, struct toml_node* node, char*
 
 %%write data;
 
-static struct toml_stack_item*
-make_stack_item(struct toml_node* node)
+
+static const struct toml_limits no_limits;
+
+/* A parser filling in doc, or with events set only reporting what it sees */
+static struct toml_parser*
+parser_new(struct toml_document* doc, const struct toml_events* events, void* ctx)
 {
-	struct toml_stack_item* ret;
+	struct toml_parser*		parser;
+	struct toml_stack_item*	root;
 
-	ret = malloc(sizeof(*ret));
-	ret->list_type = 0;
-	ret->node = node;
+	parser = calloc(1, sizeof(*parser));
+	if (!parser)
+		return NULL;
 
-	return ret;
+	root = make_stack_item(TOML_ROOT, doc ? &doc->root : NULL);
+	if (!root) {
+		free(parser);
+		return NULL;
+	}
+
+	parser->doc = doc;
+	parser->events = events;
+	parser->events_ctx = ctx;
+	parser->limits = doc ? &doc->limits : &no_limits;
+	parser->cur_line = 1;
+	parser->check_utf8 = true;
+	list_head_init(&parser->context_stack);
+	PUSH_CONTEXT(root);
+
+	%% write init;
+
+	return parser;
 }
 
-int
-toml_parse(struct toml_node* toml_root, char* buf, int buflen)
+void
+toml_parser_free(struct toml_parser* parser)
 {
-	int indent = 0, cs, cur_line = 1;
-	char *p, *pe;
-	char *ts;
-	char string[1024], *strp;
-	int precision;
-	int namelen;
-	int64_t number;
-	bool negative;
-	struct tm tm;
-	double floating;
-	char *name;
-	char *parse_error = NULL;
-	int malloc_error = 0;
-	char* utf_start;
-	int top = 0, stack[1024];
-	int in_text = 0;
-	int time_offset = 0;
-	char* secfrac_ptr;
-	bool time_offset_is_negative = 0;
-	bool time_offset_is_zulu = 0;
-	bool exponent = false;
-
-	struct list_head context_stack;
-	list_head_init(&context_stack);
-
-	struct toml_stack_item* root = make_stack_item(toml_root);
-
-	PUSH_CONTEXT(root);
+	while (!list_empty(&parser->context_stack)) {
+		struct toml_node* x;
+		POP_CONTEXT(x);
+	}
 
-	assert(toml_root->type == TOML_ROOT);
+	if (parser->doc)
+		toml_uncharge(parser->doc, parser->string_size + parser->carry_size);
 
-	%% write init;
+	free(parser->parse_error);
+	free(parser->string);
+	free(parser->carry);
+	free(parser);
+}
 
-	p = buf;
-	pe = buf + buflen + 1;
+/* Run the machine over [p, pe), non-zero once the input is known to be bad */
+static int
+parser_exec(struct toml_parser* parser, char* p, char* pe)
+{
+	struct toml_document*	doc = parser->doc;
+	struct toml_node*		toml_root = doc ? &doc->root : NULL;
+	int						left;
 
 	%% write exec;
 
-	if (malloc_error) {
-		fprintf(stderr, "malloc failed, line %d\n", cur_line);
-		return 1;
-	}
+	left = pe - p < 5 ? (int)(pe - p) : 5;
 
-	if (parse_error) {
-		fprintf(stderr, "%s at %d p = %.5s\n", parse_error, cur_line, p);
-		free(parse_error);
-		return 1;
+	/* an event handler asked to stop, nothing is wrong with the input */
+	if (parser->abort)
+		goto fail;
+
+	if (parser->malloc_error) {
+		REPORT("%s, line %d\n", doc && doc->limit ? doc->limit : "malloc failed",
+															parser->cur_line);
+		goto fail;
 	}
 
-	if (in_text) {
-		fprintf(stderr, "not in start, line %d\n", cur_line);
-		return 1;
+	if (parser->parse_error) {
+		REPORT("%s at %d p = %.*s\n", parser->parse_error,
+												parser->cur_line, left, p);
+		goto fail;
 	}
 
 	/* check we have consumed the entire buffer */
 	if (p != pe) {
-		fprintf(stderr, "entire buffer unconsumed, line %d\n", cur_line);
+		REPORT("entire buffer unconsumed, line %d\n", parser->cur_line);
+		goto fail;
+	}
+
+	if (parser->cs == toml_error) {
+		REPORT("PARSE_ERROR, line %d, p = '%.*s'", parser->cur_line,
+																	left, p);
+		goto fail;
+	}
+
+	return 0;
+
+fail:
+	parser->failed = true;
+	return 1;
+}
+
+/* Move the pointers into [from, end] over to the same offsets from to */
+static void
+parser_rebase(struct toml_parser* parser, char* from, char* end, char* to)
+{
+	char**	ptrs[] = {
+		&parser->ts, &parser->str_start, &parser->utf_start,
+	};
+	size_t	i;
+
+	for (i = 0; i < sizeof(ptrs) / sizeof(ptrs[0]); i++) {
+		if (*ptrs[i] && *ptrs[i] >= from && *ptrs[i] <= end)
+			*ptrs[i] = to + (*ptrs[i] - from);
+	}
+}
+
+#define CARRY_SLICE	4096
+
+/*
+ * Keep the open token, which runs up to end, at the front of the carry buffer
+ * with room for more bytes behind it.
+ */
+static int
+carry_keep(struct toml_parser* parser, char* end, size_t room)
+{
+	char*	start = *parser->token;
+	size_t	len = end - start;
+	size_t	size = parser->carry_size ? parser->carry_size : CARRY_SLICE;
+
+	if (len + room > parser->carry_size) {
+		char* carry;
+
+		while (size < len + room)
+			size *= 2;
+
+		/* counted as the buffer it replaces is given back */
+		if (parser->doc && !toml_charge(parser->doc, size - parser->carry_size))
+			return ENOMEM;
+
+		carry = malloc(size);
+		if (!carry) {
+			if (parser->doc)
+				toml_uncharge(parser->doc, size - parser->carry_size);
+			return ENOMEM;
+		}
+
+		memcpy(carry, start, len);
+		parser_rebase(parser, start, end, carry);
+		free(parser->carry);
+		parser->carry = carry;
+		parser->carry_size = size;
+	} else if (start != parser->carry) {
+		memmove(parser->carry, start, len);
+		parser_rebase(parser, start, end, parser->carry);
+	}
+
+	parser->carry_len = len;
+	return 0;
+}
+
+/*
+ * Check the next input is UTF-8, before the machine sees it.  The start of a
+ * character the chunk ends in the middle of is kept, to be checked once the
+ * rest of it comes.
+ */
+static bool
+utf8_feed(struct toml_parser* parser, const char* p, const char* pe)
+{
+	const char*	end;
+	bool		partial;
+	int			line = parser->cur_line;
+
+	while (parser->utf8_len && p < pe) {
+		parser->utf8[parser->utf8_len++] = *p++;
+		end = toml_utf8_check(parser->utf8, parser->utf8 + parser->utf8_len,
+																	&partial);
+		if (end == parser->utf8 + parser->utf8_len)
+			parser->utf8_len = 0;
+		else if (!partial)
+			goto bad;
+	}
+
+	end = toml_utf8_check(p, pe, &partial);
+	if (end == pe)
+		return true;
+
+	if (partial) {
+		memcpy(parser->utf8, end, pe - end);
+		parser->utf8_len = pe - end;
+		return true;
+	}
+
+	for (; p < end; p++)
+		line += *p == '\n';
+
+bad:
+	REPORT("invalid UTF-8, line %d\n", line);
+	return false;
+}
+
+/* Feed the machine the next len bytes of input */
+static int
+parser_feed(struct toml_parser* parser, const char* buf, size_t len)
+{
+	char*	p = (char*)buf;
+	char*	pe = p + len;
+	char*	end = NULL;
+
+	if (parser->failed)
+		return 1;
+
+	if (parser->check_utf8 && !utf8_feed(parser, buf, buf + len)) {
+		parser->failed = true;
 		return 1;
 	}
 
-	if (cs == toml_error) {
-		fprintf(stderr, "PARSE_ERROR, line %d, p = '%.5s'", cur_line, p);
+	/*
+	 * A token left open by the last chunk is finished in the carry buffer,
+	 * which is fed this chunk a slice at a time until the token is complete.
+	 */
+	while (parser->token && p < pe) {
+		size_t	slice = pe - p < CARRY_SLICE ? pe - p : CARRY_SLICE;
+		char*	q;
+
+		if (carry_keep(parser, parser->carry + parser->carry_len, slice))
+			goto nomem;
+
+		q = parser->carry + parser->carry_len;
+		memcpy(q, p, slice);
+		parser->carry_len += slice;
+		p += slice;
+		end = q + slice;
+
+		if (parser_exec(parser, q, end))
+			return 1;
+	}
+
+	if (p < pe) {
+		end = pe;
+		if (parser_exec(parser, p, pe))
+			return 1;
+	}
+
+	if (parser->token && end && carry_keep(parser, end, 0))
+		goto nomem;
+
+	return 0;
+
+nomem:
+	REPORT("%s, line %d\n", parser->doc && parser->doc->limit ?
+							parser->doc->limit : "malloc failed", parser->cur_line);
+	parser->failed = true;
+	return 1;
+}
+
+/* The input is complete, check it ended where a document may end */
+static int
+parser_finish(struct toml_parser* parser)
+{
+	static const char eof = '\0';
+
+	/* the machine expects the input to end with a NUL */
+	if (parser_feed(parser, &eof, 1))
+		return 1;
+
+	if (parser->in_text) {
+		REPORT("not in start, line %d\n", parser->cur_line);
 		return 1;
 	}
 
 	return 0;
 }
+
+/*
+ * Parse the next len bytes of a document.  Chunks may be cut anywhere, even in
+ * the middle of a token, and buf need not outlive the call.
+ */
+int
+toml_parse_chunk(struct toml_node* toml_root, const char* buf, size_t len)
+{
+	struct toml_document* doc;
+
+	assert(toml_root->type == TOML_ROOT);
+	doc = toml_document(toml_root);
+
+	if (!doc->parser) {
+		doc->parser = parser_new(doc, NULL, NULL);
+		if (!doc->parser)
+			return 1;
+	}
+
+	return parser_feed(doc->parser, buf, len);
+}
+
+/* The input is complete, check the document and drop the parser state */
+int
+toml_parse_finish(struct toml_node* toml_root)
+{
+	struct toml_document*	doc;
+	int						ret;
+
+	assert(toml_root->type == TOML_ROOT);
+	doc = toml_document(toml_root);
+
+	if (!doc->parser) {
+		doc->parser = parser_new(doc, NULL, NULL);
+		if (!doc->parser)
+			return 1;
+	}
+
+	ret = parser_finish(doc->parser);
+
+	toml_parser_free(doc->parser);
+	doc->parser = NULL;
+
+	return ret;
+}
+
+/*
+ * Run through buf reporting what is in it to events instead of building a
+ * tree.  Names and values handed to the callbacks are only valid during the
+ * call and, as nothing is kept, duplicate keys and tables are not noticed.
+ */
+int
+toml_parse_events(char* buf, int buflen, const struct toml_events* events, void* ctx)
+{
+	struct toml_parser*	parser;
+	int					ret;
+
+	parser = parser_new(NULL, events, ctx);
+	if (!parser)
+		return 1;
+
+	ret = parser_feed(parser, buf, buflen);
+	if (!ret)
+		ret = parser_finish(parser);
+	if (parser->abort)
+		ret = parser->abort;
+
+	toml_parser_free(parser);
+
+	return ret;
+}
+
+/*
+ * Parse one piece of a bigger document, which starts on the given line, into
+ * root, logging its table headers.  Nothing is reported, a piece that fails
+ * is for the caller to deal with.
+ */
+int
+toml_parse_segment(struct toml_node* toml_root, char* buf, size_t len,
+					int line, unsigned int flags, struct toml_sections* log)
+{
+	struct toml_parser*	parser;
+	int					ret;
+
+	parser = parser_new(toml_document(toml_root), NULL, NULL);
+	if (!parser)
+		return 1;
+
+	parser->cur_line = line;
+	parser->check_utf8 = !(flags & TOML_PARSE_TRUSTED);
+	parser->quiet = true;
+	parser->sections = log;
+
+	ret = parser_feed(parser, buf, len);
+	if (!ret)
+		ret = parser_finish(parser);
+
+	toml_parser_free(parser);
+
+	return ret;
+}
+
+/*
+ * Parse pieces of a document, each starting on its own line, as if they were
+ * all there is to it, logging its table headers.  This is how a lazy parse
+ * reads what comes before the first header and the headers themselves.
+ */
+int
+toml_parse_spans(struct toml_node* toml_root, const struct toml_span* spans,
+				size_t count, unsigned int flags, struct toml_sections* log)
+{
+	struct toml_parser*	parser;
+	size_t				i;
+	int					ret = 0;
+
+	parser = parser_new(toml_document(toml_root), NULL, NULL);
+	if (!parser)
+		return 1;
+
+	parser->check_utf8 = !(flags & TOML_PARSE_TRUSTED);
+	parser->sections = log;
+
+	for (i = 0; i < count && !ret; i++) {
+		parser->cur_line = spans[i].line;
+		ret = parser_feed(parser, spans[i].start, spans[i].len);
+	}
+	if (!ret)
+		ret = parser_finish(parser);
+
+	toml_parser_free(parser);
+
+	return ret;
+}
+
+/* The keys of a table whose header has already been seen, into table */
+int
+toml_parse_body(struct toml_document* doc, struct toml_node* table,
+							const struct toml_span* body, unsigned int flags)
+{
+	struct toml_parser*		parser;
+	struct toml_stack_item*	context;
+	int						ret;
+
+	parser = parser_new(doc, NULL, NULL);
+	if (!parser)
+		return 1;
+
+	context = make_stack_item(TOML_TABLE, table);
+	if (!context) {
+		toml_parser_free(parser);
+		return 1;
+	}
+	PUSH_CONTEXT(context);
+
+	parser->cur_line = body->line;
+	parser->check_utf8 = !(flags & TOML_PARSE_TRUSTED);
+
+	ret = parser_feed(parser, body->start, body->len);
+	if (!ret)
+		ret = parser_finish(parser);
+
+	toml_parser_free(parser);
+
+	return ret;
+}
+
+/* All of a document in one go */
+int
+toml_parse_buffer(struct toml_node* toml_root, char* buf, size_t len,
+														unsigned int flags)
+{
+	struct toml_document*	doc = toml_document(toml_root);
+	int						ret;
+
+	if (!doc->parser) {
+		doc->parser = parser_new(doc, NULL, NULL);
+		if (!doc->parser)
+			return 1;
+	}
+	doc->parser->check_utf8 = !(flags & TOML_PARSE_TRUSTED);
+
+	ret = toml_parse_chunk(toml_root, buf, len);
+	if (toml_parse_finish(toml_root))
+		ret = 1;
+
+	return ret;
+}
+
+int
+toml_parse_with_opts(struct toml_node* toml_root, char* buf, int buflen,
+										const struct toml_parse_opts* opts)
+{
+	struct toml_document*	doc;
+	int						ret;
+
+	assert(toml_root->type == TOML_ROOT);
+	doc = toml_document(toml_root);
+
+	if (opts)
+		doc->limits = opts->limits;
+	doc->flags = opts ? opts->flags : 0;
+	doc->limit = NULL;
+
+	if (opts && (opts->flags & TOML_PARSE_BORROW) && toml_borrow(doc, buf, buflen))
+		return 1;
+
+	if (opts && (opts->flags & TOML_PARSE_LAZY))
+		return toml_parse_lazy(toml_root, buf, buflen, opts->flags);
+
+	if (opts && opts->threads > 1)
+		return toml_parse_parallel(toml_root, buf, buflen, opts);
+
+	return toml_parse_buffer(toml_root, buf, buflen, opts ? opts->flags : 0);
+}
+
+int
+toml_parse(struct toml_node* toml_root, char* buf, int buflen)
+{
+	return toml_parse_with_opts(toml_root, buf, buflen, NULL);
+}
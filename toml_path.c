@@ -0,0 +1,207 @@
+#include "toml.h"
+#include "toml_private.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * A dotted path split up ahead of time, so that looking it up is just a walk
+ * down the tree comparing names whose lengths and hashes are already known.
+ */
+
+struct toml_path_segment {
+	const char*	name;
+	size_t		len;
+	uint32_t	hash;
+};
+
+struct toml_path {
+	unsigned int				count;
+	struct toml_path_segment	segments[];
+	/* followed by a copy of the path the names point into */
+};
+
+/*
+ * Split the first segment off path.  A segment in quotes is taken as it
+ * stands, dots and all.  Returns the '.' or NUL ending the segment, or NULL if
+ * the path is malformed.
+ */
+const char*
+toml_path_segment(const char* path, const char** name, size_t* len)
+{
+	const char* end;
+
+	if (*path == '"' || *path == '\'') {
+		end = strchr(path + 1, *path);
+		if (!end)
+			return NULL;
+
+		*name = path + 1;
+		*len = end - path - 1;
+		end++;
+
+		if (*end != '.' && *end != '\0')
+			return NULL;
+
+		return end;
+	}
+
+	end = path + strcspn(path, ".");
+	*name = path;
+	*len = end - path;
+
+	return end;
+}
+
+struct toml_path*
+toml_path_compile(const char* path)
+{
+	struct toml_path*	ret;
+	const char*			seg = path;
+	const char*			name;
+	size_t				len, size;
+	unsigned int		count = 0;
+	char*				copy;
+
+	for (;;) {
+		seg = toml_path_segment(seg, &name, &len);
+		if (!seg)
+			return NULL;
+
+		count++;
+		if (!*seg++)
+			break;
+	}
+
+	size = sizeof(*ret) + count * sizeof(ret->segments[0]);
+	ret = malloc(size + strlen(path) + 1);
+	if (!ret)
+		return NULL;
+
+	copy = (char*)ret + size;
+	strcpy(copy, path);
+
+	ret->count = count;
+	for (seg = copy, count = 0; count < ret->count; count++) {
+		seg = toml_path_segment(seg, &name, &len);
+
+		ret->segments[count].name = name;
+		ret->segments[count].len = len;
+		ret->segments[count].hash = toml_hash(name, len);
+		seg++;
+	}
+
+	return ret;
+}
+
+struct toml_node*
+toml_get_compiled(struct toml_node* node, const struct toml_path* path)
+{
+	const struct toml_path_segment*	seg = path->segments;
+	const struct toml_path_segment*	end = seg + path->count;
+
+	for (; node && seg < end; seg++)
+		node = toml_table_lookup_hashed(node, seg->name, seg->len, seg->hash);
+
+	return node;
+}
+
+void
+toml_path_free(struct toml_path* path)
+{
+	free(path);
+}
+
+/*
+ * Many paths are looked up at once by taking them in sorted order, so that
+ * each one starts from wherever the one before it got to along the segments
+ * they share.
+ */
+
+struct sorted_key {
+	const char*	key;
+	size_t		at;			/* in the caller's array */
+};
+
+struct resolved {
+	const char*			name;
+	size_t				len;
+	struct toml_node*	node;
+};
+
+static int
+sorted_key_cmp(const void* a, const void* b)
+{
+	return strcmp(((const struct sorted_key*)a)->key,
+									((const struct sorted_key*)b)->key);
+}
+
+int
+toml_get_many(struct toml_node* root, const char** keys, size_t n,
+													struct toml_node** nodes)
+{
+	struct sorted_key*	sorted;
+	struct resolved*	levels = NULL;
+	struct resolved*	more;
+	struct toml_node*	node;
+	const char*			seg;
+	const char*			name;
+	size_t				len, i, depth = 0, size = 0, level;
+
+	sorted = malloc(n * sizeof(*sorted));
+	if (!sorted && n)
+		return ENOMEM;
+
+	for (i = 0; i < n; i++) {
+		sorted[i].key = keys[i];
+		sorted[i].at = i;
+	}
+	qsort(sorted, n, sizeof(*sorted), sorted_key_cmp);
+
+	for (i = 0; i < n; i++) {
+		node = root;
+		seg = sorted[i].key;
+
+		for (level = 0; node; level++) {
+			seg = toml_path_segment(seg, &name, &len);
+			if (!seg) {
+				node = NULL;
+				break;
+			}
+
+			if (level < depth && levels[level].len == len &&
+								memcmp(levels[level].name, name, len) == 0) {
+				node = levels[level].node;
+			} else {
+				if (level == size) {
+					size = size ? size * 2 : 16;
+					more = realloc(levels, size * sizeof(*levels));
+					if (!more) {
+						free(levels);
+						free(sorted);
+						return ENOMEM;
+					}
+					levels = more;
+				}
+
+				node = toml_table_lookup_hashed(node, name, len,
+														toml_hash(name, len));
+				levels[level].name = name;
+				levels[level].len = len;
+				levels[level].node = node;
+				depth = level + 1;
+			}
+
+			if (!*seg++)
+				break;
+		}
+
+		nodes[sorted[i].at] = node;
+	}
+
+	free(levels);
+	free(sorted);
+
+	return 0;
+}
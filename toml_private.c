@@ -27,43 +27,138 @@ toml_type_to_str(enum toml_type type)
 #undef CASE_ENUM_TO_STR
 }
 
+/*
+ * Node itself, or for a flat node a copy of it in view.  Either way the
+ * result has no children to speak of, they are found with toml_first_child().
+ */
+struct toml_node*
+toml_view(struct toml_node* node, struct toml_node* view)
+{
+	return toml_is_flat(node) ? toml_flat_view(node, view) : node;
+}
+
+/* Table and list items are laid out alike, either will do for both */
+struct toml_node*
+toml_first_child(struct toml_node* node)
+{
+	if (toml_is_flat(node))
+		return toml_flat_first(node);
+
+	switch (node->type) {
+	case TOML_TABLE:
+		if (toml_is_lazy(node) && toml_lazy_load(node))
+			return NULL;
+		/* FALLTHROUGH */
+	case TOML_ROOT:
+	case TOML_INLINE_TABLE:
+	case TOML_LIST:
+	case TOML_TABLE_ARRAY:
+		if (list_empty(&node->value.list))
+			return NULL;
+		return &list_top(&node->value.list, struct toml_list_item, list)->node;
+
+	default:
+		return NULL;
+	}
+}
+
+/* The child after child, NULL after the last */
+struct toml_node*
+toml_next_child(struct toml_node* node, struct toml_node* child)
+{
+	struct toml_list_item* item;
+
+	if (toml_is_flat(node))
+		return toml_flat_next(node, child);
+
+	item = container_of(child, struct toml_list_item, node);
+	if (item->list.next == &node->value.list.n)
+		return NULL;
+
+	return &container_of(item->list.next, struct toml_list_item, list)->node;
+}
+
 static struct toml_node*
-InsertAnonymousTable(struct toml_node* place)
+InsertAnonymousTable(struct toml_document* doc, struct toml_node* place)
 {
 	struct toml_table_item* new_table;
-	new_table = malloc(sizeof(*new_table));
+	if (!toml_count_node(doc))
+		return NULL;
+	new_table = toml_alloc(doc, sizeof(*new_table));
+	if (!new_table) {
+		toml_uncount_node(doc);
+		return NULL;
+	}
 	new_table->node.type = TOML_TABLE;
 	new_table->node.name = NULL;
+	new_table->node.name_len = 0;
+	new_table->node.index = NULL;
 	list_head_init(&new_table->node.value.map);
 	list_add_tail(&place->value.list, &new_table->map);
 	return &new_table->node;
 }
 
 static struct toml_node*
-InsertTableArray(char* name, struct toml_node* place)
+InsertTableArray(struct toml_document* doc, const char* name, size_t len, struct toml_node* place)
 {
 	struct toml_table_item* item;
 
-	item = malloc(sizeof(*item));
+	item = toml_alloc(doc, sizeof(*item));
+	if (!item)
+		return NULL;
 	item->node.type = TOML_TABLE_ARRAY;
-	item->node.name = strdup(name);
+	item->node.name = toml_strview(doc, name, len);
+	if (!item->node.name) {
+		toml_release(doc, item);
+		return NULL;
+	}
+	item->node.name_len = len;
+	item->node.index = NULL;
 	list_head_init(&item->node.value.list);
-	list_add_tail(&place->value.map, &item->map);
+	if (toml_table_add(doc, place, item)) {
+		if (!toml_is_borrowed(doc, item->node.name))
+			toml_release(doc, item->node.name);
+		toml_release(doc, item);
+		return NULL;
+	}
 
-	return InsertAnonymousTable(&item->node);
+	return InsertAnonymousTable(doc, &item->node);
+}
+
+/* A path running through a table array carries on in its last table */
+static struct toml_node*
+LastTable(struct toml_node* place)
+{
+	if (place->type != TOML_TABLE_ARRAY)
+		return place;
+
+	return &list_tail(&place->value.list, struct toml_list_item, list)->node;
+}
+
+/* The end of the dot separated segment of a table name starting at seg */
+static const char*
+SegmentEnd(const char* seg, const char* end)
+{
+	const char* dot = memchr(seg, '.', end - seg);
+
+	return dot ? dot : end;
 }
 
 int
-SawTableArray(struct toml_node* root, char* tableArrayName, struct toml_node** lastTable, char** err)
+SawTableArray(struct toml_node* root, const char* tableArrayName, size_t len, struct toml_node** lastTable, char** err)
 {
-	char*					ancestor;
-	bool					found = false;
-	struct toml_table_item*	item;
+	const char*				ancestor;
+	const char*				ancestor_end;
+	const char*				end = tableArrayName + len;
+	struct toml_node*		found = NULL;
 	struct toml_node*		place;
+	struct toml_document*	doc;
 
 	if (root->type != TOML_ROOT)
 		return 1;
 
+	doc = toml_document(root);
+
 	/*
 	 * A table array is a list of anonymous tables.  Every time we see [[<table>]]
 	 * we should first instantiate <table> if it does not already exist.  Once we
@@ -72,97 +167,111 @@ SawTableArray(struct toml_node* root, char* tableArrayName, struct toml_node** l
 	 */
 	place = root;
 
-	while ((ancestor = strsep(&tableArrayName, "."))) {
-		found = false;
+	for (ancestor = tableArrayName; ; ancestor = ancestor_end + 1) {
+		ancestor_end = SegmentEnd(ancestor, end);
+		place = LastTable(place);
 
-		list_for_each(&place->value.map, item, map) {
-			if (!item->node.name)
-				continue;
-
-			if (!strcmp(item->node.name, ancestor))
-			{
-				struct toml_list_item* last;
-				last = list_tail(&item->node.value.list, struct toml_list_item, list);
-				place = &last->node;
-				found = true;
-				break;
-			}
+		found = toml_table_lookup(doc, place, ancestor, ancestor_end - ancestor);
+		if (found) {
+			place = found;
+		} else if (place->type != TOML_TABLE && place->type != TOML_ROOT) {
+			asprintf(err, "Attempt to extend %.*s", (int)len, tableArrayName);
+			return 3;
+		} else {
+			/* this is the instantiation of <table> or one of its sub-parts */
+			place = InsertTableArray(doc, ancestor, ancestor_end - ancestor, place);
+			if (!place)
+				return ENOMEM;
+			*lastTable = place;
 		}
 
-		if (found)
-			continue;
-
-		/* this is the instantiation of <table> or one of its sub-parts */
-		place = InsertTableArray(ancestor, place);
-		*lastTable = place;
+		if (ancestor_end == end)
+			break;
 	}
 
 	/* This is the creation of an anoymous table once we reach the base of tableArrayName */
-	if (found)
-		*lastTable = InsertAnonymousTable(&item->node);
+	if (found) {
+		if (found->type != TOML_TABLE_ARRAY) {
+			asprintf(err, "Attempt to redefine %.*s as a table array", (int)len, tableArrayName);
+			return 3;
+		}
+
+		*lastTable = InsertAnonymousTable(doc, found);
+		if (!*lastTable)
+			return ENOMEM;
+	}
 
 	return 0;
 }
 
 int
-SawTable(struct toml_node* place, char* name, struct toml_node** lastTable, char** err)
+SawTable(struct toml_node* place, const char* name, size_t len, struct toml_node** lastTable, char** err)
 {
-	char *ancestor, *tofree = NULL, *tablename;
-	int item_added = 0;
-
-	tofree = tablename = strdup(name);
-	if (!tablename)
-		return ENOMEM;
+	const char *ancestor, *ancestor_end, *end = name + len;
+	int item_added = 0, ret;
+	struct toml_document *doc = toml_document(place);
 
-	while ((ancestor = strsep(&tablename, "."))) {
+	for (ancestor = name; ; ancestor = ancestor_end + 1) {
 		struct toml_table_item *item = NULL;
-		int found = 0;
+		struct toml_node *found;
 
-		if (strcmp(ancestor, "") == 0) {
+		ancestor_end = SegmentEnd(ancestor, end);
+		if (ancestor == ancestor_end) {
 			asprintf(err, "empty implicit table");
 			return 1;
 		}
 
-		list_for_each(&place->value.map, item, map) {
-			if (!item->node.name)
-				continue;
-
-			if (strcmp(item->node.name, ancestor) == 0) {
-				place = &item->node;
-				found = 1;
-				break;
-			}
-		}
+		place = LastTable(place);
 
-		if (found)
-			continue;
+		found = toml_table_lookup(doc, place, ancestor, ancestor_end - ancestor);
+		if (found) {
+			place = found;
+		} else if (place->type != TOML_TABLE && place->type != TOML_ROOT) {
+			asprintf(err, "Attempt to overwrite table %.*s", (int)len, name);
+			return 3;
+		} else {
+			/* this is the auto-vivification */
+			item = toml_alloc(doc, sizeof(*item));
+			if (!item)
+				return ENOMEM;
 
-		/* this is the auto-vivification */
-		item = malloc(sizeof(*item));
-		if (!item)
-			return ENOMEM;
+			item->node.name = toml_strview(doc, ancestor, ancestor_end - ancestor);
+			if (!item->node.name) {
+				toml_release(doc, item);
+				return ENOMEM;
+			}
+			item->node.name_len = ancestor_end - ancestor;
+			item->node.type = TOML_TABLE;
+			item->node.index = NULL;
+			list_head_init(&item->node.value.map);
+			ret = toml_table_add(doc, place, item);
+			if (ret) {
+				if (!toml_is_borrowed(doc, item->node.name))
+					toml_release(doc, item->node.name);
+				toml_release(doc, item);
+				if (ret == EINVAL)
+					asprintf(err, "table %.*s could not be read", (int)len, name);
+				return ret;
+			}
 
-		item->node.name = strdup(ancestor);
-		item->node.type = TOML_TABLE;
-		list_head_init(&item->node.value.map);
-		list_add_tail(&place->value.map, &item->map);
+			place = &item->node;
+			item_added = 1;
+		}
 
-		place = &item->node;
-		item_added = 1;
+		if (ancestor_end == end)
+			break;
 	}
 
 	if (!item_added) {
-		asprintf(err, "Duplicate item %s", name);
+		asprintf(err, "Duplicate item %.*s", (int)len, name);
 		return 2;
 	}
 
 	if (place->type != TOML_TABLE) {
-		asprintf(err, "Attempt to overwrite table %s", name);
+		asprintf(err, "Attempt to overwrite table %.*s", (int)len, name);
 		return 3;
 	}
 
-	free(tofree);
-
 	*lastTable = place;
 	return 0;
 }
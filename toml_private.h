@@ -7,8 +7,16 @@
 
 #include "toml.h"
 
+struct toml_table_index;
+
+/*
+ * Names and strings carry their length.  When a document borrows its input
+ * (TOML_PARSE_BORROW) they may point straight into that buffer and are then
+ * not NUL terminated.
+ */
 struct toml_node {
 	enum toml_type type;
+	uint32_t name_len;
 	char *name;
 	union {
 		struct list_head map;
@@ -18,15 +26,20 @@ struct toml_node {
 			double	value;
 			int		precision;
 		} floating;
-		char *string;
 		struct {
-			time_t	epoch;
-			int		sec_frac;
-			bool	offset_sign_negative;
-			uint8_t	offset;
-			bool	offset_is_zulu;
+			char	*string;
+			size_t	string_len;
+		};
+		struct {
+			time_t		epoch;					/* UTC */
+			uint32_t	sec_frac;
+			int16_t		offset;					/* minutes ahead of UTC */
+			uint8_t		sec_frac_digits:4;
+			uint8_t		offset_sign_negative:1;	/* -00:00 is not Z */
+			uint8_t		offset_is_zulu:1;
 		} rfc3339_time;
 	} value;
+	struct toml_table_index* index;		/* tables only, see toml_index.c */
 };
 
 struct toml_table_item {
@@ -39,8 +52,212 @@ struct toml_list_item {
 	struct toml_node node;
 };
 
+struct toml_arena;
+
+/* An input buffer that nodes of a document may point into */
+struct toml_borrowed {
+	const char*				start;
+	const char*				end;
+	struct toml_borrowed*	next;
+};
+
+/*
+ * The root node handed out by toml_init() is embedded in a document which
+ * owns everything hanging off it.
+ */
+struct toml_parser;
+
+struct toml_document {
+	struct toml_node		root;
+	struct toml_arena*		arena;
+	struct toml_borrowed*	borrowed;
+	struct toml_parser*		parser;		/* while input is fed in chunks */
+	struct toml_lazy*		lazy;		/* tables still to be read */
+	bool					lazy_failed;	/* one of them would not be */
+	struct toml_outline*	outline;	/* of the last toml_reparse() */
+	unsigned int			flags;		/* it was parsed with, for toml_reparse() */
+	struct toml_limits		limits;
+	size_t					nodes;		/* counted when limited */
+	size_t					allocated;
+	const char*				limit;		/* the one a parse went past */
+};
+
+#define toml_document(x)	container_of(x, struct toml_document, root)
+
+/* A table header met by the parser and the table it opened */
+struct toml_section {
+	const char*			name;		/* points into the input */
+	size_t				name_len;
+	int					line;
+	bool				array;
+	struct toml_node*	table;
+};
+
+struct toml_sections {
+	struct toml_section*	v;
+	size_t					count;
+	size_t					size;
+};
+
+/* A stretch of input, and the line it starts on */
+struct toml_span {
+	char*	start;
+	size_t	len;
+	int		line;
+};
+
+/*
+ * A table of a lazily parsed document whose body is still to be read has one
+ * of these in place of its index, marked by the low bit (see toml_lazy.c).
+ */
+struct toml_lazy {
+	struct toml_document*		doc;
+	struct toml_node*			table;		/* NULL once read */
+	struct toml_span			body;
+	unsigned int				flags;
+	struct toml_table_index*	index;		/* the table's own, meanwhile */
+	bool						failed;		/* its body would not parse */
+	struct toml_lazy*			next;
+};
+
+#define toml_is_lazy(x)		((uintptr_t)(x)->index & 1)
+
+/*
+ * A document flattened into one block of memory (see toml_snapshot.c), by
+ * toml_flatten() or from a snapshot.  Its nodes are records in document order
+ * that refer to their names and strings by offsets from themselves, and are
+ * handed out as struct toml_node whose type has TOML_FLAT set.  Anything not
+ * just passing them on must go through toml_view() and
+ * toml_first_child()/toml_next_child().
+ */
+#define TOML_FLAT				0x100
+#define toml_is_flat(x)			((x)->type & TOML_FLAT)
+
+#define TOML_FLAT_DATE_NEGATIVE	(1 << 0)
+#define TOML_FLAT_DATE_ZULU		(1 << 1)
+
+struct toml_flat_node {
+	uint32_t	type;		/* enum toml_type | TOML_FLAT */
+	uint32_t	name_len;
+	int64_t		name;		/* 0 if none */
+	union {
+		struct {
+			uint32_t	count;
+			uint32_t	end;		/* records on to the end of the subtree */
+			int64_t		index;		/* of a big table's hash index, or 0 */
+		} container;
+		int64_t		integer;
+		struct {
+			double		value;
+			int32_t		precision;
+		} floating;
+		struct {
+			int64_t		offset;
+			uint64_t	len;
+		} string;
+		struct {
+			int64_t		epoch;
+			uint32_t	sec_frac;
+			int16_t		offset;
+			uint8_t		sec_frac_digits;
+			uint8_t		flags;		/* TOML_FLAT_DATE_* */
+		} date;
+	} value;
+};
+
+/* Ahead of the root node */
+struct toml_flat_header {
+	char		magic[8];
+	uint32_t	version;
+	uint32_t	node_size;
+	uint64_t	size;		/* of the whole image */
+	uint64_t	flags;
+};
+
+struct toml_node* toml_view(struct toml_node*, struct toml_node*);
+struct toml_node* toml_first_child(struct toml_node*);
+struct toml_node* toml_next_child(struct toml_node*, struct toml_node*);
+
+void toml_flat_free(struct toml_node*);
+void toml_flat_walk(struct toml_node*, toml_node_walker, void*);
+struct toml_node* toml_flat_view(struct toml_node*, struct toml_node*);
+struct toml_node* toml_flat_first(struct toml_node*);
+struct toml_node* toml_flat_next(struct toml_node*, struct toml_node*);
+struct toml_node* toml_flat_lookup(struct toml_node*, const char*, size_t, uint32_t);
+
+struct toml_arena* toml_arena_new(void);
+void* toml_arena_alloc(struct toml_arena*, size_t);
+void toml_arena_destroy(struct toml_arena*);
+void toml_arena_adopt(struct toml_arena*, struct toml_arena*);
+
+bool toml_charge(struct toml_document*, size_t);
+void toml_uncharge(struct toml_document*, size_t);
+bool toml_count_node(struct toml_document*);
+void toml_uncount_node(struct toml_document*);
+void* toml_alloc(struct toml_document*, size_t);
+void toml_release(struct toml_document*, void*);
+char* toml_strndup(struct toml_document*, const char*, size_t);
+int toml_borrow(struct toml_document*, const char*, size_t);
+bool toml_is_borrowed(struct toml_document*, const char*);
+char* toml_strview(struct toml_document*, const char*, size_t);
+
+void toml_parser_free(struct toml_parser*);
+bool toml_decimal_to_double(uint64_t, int, bool, bool, double*);
+double toml_strtod(const char*, size_t);
+bool toml_epoch(int64_t, int, int, int, int, int, int, time_t*);
+const char* toml_scan_string(const char*, const char*, char, char, int*);
+typedef bool (*toml_header_fn)(void* ctx, char* header, char* eol, int line);
+void toml_scan_headers(char*, size_t, toml_header_fn, void*);
+const char* toml_utf8_check(const char*, const char*, bool*);
+int toml_parse_buffer(struct toml_node*, char*, size_t, unsigned int);
+int toml_parse_segment(struct toml_node*, char*, size_t, int, unsigned int, struct toml_sections*);
+int toml_parse_parallel(struct toml_node*, char*, size_t, const struct toml_parse_opts*);
+int toml_parse_spans(struct toml_node*, const struct toml_span*, size_t, unsigned int, struct toml_sections*);
+int toml_parse_body(struct toml_document*, struct toml_node*, const struct toml_span*, unsigned int);
+int toml_parse_lazy(struct toml_node*, char*, size_t, unsigned int);
+int toml_lazy_load(struct toml_node*);
+int toml_parse_table(struct toml_document*, struct toml_node*, const struct toml_span*, unsigned int);
+struct toml_span* toml_outline(char*, size_t, size_t*);
+void toml_outline_body(const struct toml_span*, size_t, size_t, char*, struct toml_span*);
+void toml_lazy_free(struct toml_document*);
+
+uint32_t toml_hash(const char*, size_t);
+struct toml_node* toml_table_lookup(struct toml_document*, struct toml_node*, const char*, size_t);
+struct toml_node* toml_table_lookup_hashed(struct toml_node*, const char*, size_t, uint32_t);
+int toml_table_add(struct toml_document*, struct toml_node*, struct toml_table_item*);
+void toml_table_clear(struct toml_document*, struct toml_node*, bool);
+size_t toml_index_size(struct toml_table_index*);
+void toml_index_release(struct toml_document*, struct toml_node*);
+
+enum toml_writer_kind {
+	TOML_WRITER_BUFFER,		/* grows in memory */
+	TOML_WRITER_FD,
+	TOML_WRITER_CALLBACK,
+};
+
+struct toml_writer {
+	enum toml_writer_kind	kind;
+	char*					buf;
+	size_t					len;
+	size_t					size;
+	int						fd;
+	toml_write_fn			fn;
+	void*					ctx;
+	int						error;		/* sticky, the first failure */
+};
+
+void toml_writer_init(struct toml_writer*, enum toml_writer_kind, char*, size_t);
+void toml_write(struct toml_writer*, const char*, size_t);
+#define toml_write_str(w, s)	toml_write((w), (s), strlen(s))
+void toml_writef(struct toml_writer*, const char*, ...)
+										__attribute__((format(printf, 2, 3)));
+void toml_write_escaped(struct toml_writer*, const char*, size_t);
+void toml_write_value(struct toml_writer*, struct toml_node*);
+
+const char* toml_path_segment(const char*, const char**, size_t*);
+
 const char* toml_type_to_str(enum toml_type);
-int SawTableArray(struct toml_node*, char*, struct toml_node**, char**);
-int SawTable(struct toml_node*, char*, struct toml_node**, char**);
+int SawTableArray(struct toml_node*, const char*, size_t, struct toml_node**, char**);
+int SawTable(struct toml_node*, const char*, size_t, struct toml_node**, char**);
 
 #endif /* _TOML_PRIVATE_H */
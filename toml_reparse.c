@@ -0,0 +1,172 @@
+#include "toml.h"
+#include "toml_private.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * A document parsed by toml_reparse() keeps a copy of its input and where in
+ * it each table header line and the body under it lie, along with the table
+ * the header made.  Given the document's input again after an edit, if the
+ * headers are all as they were only the bodies that changed are parsed again,
+ * each into its own table once the keys it had are taken out.  Tables whose
+ * bodies did not change are not touched, so whatever points into them stays
+ * good.  Any other edit, and the first toml_reparse() of a document, parses
+ * it all.
+ */
+
+struct toml_outline_section {
+	size_t				header;		/* offsets into text */
+	size_t				header_len;
+	size_t				body;
+	size_t				body_len;
+	struct toml_node*	table;
+};
+
+/* The first section is whatever comes ahead of the first header */
+struct toml_outline {
+	char*						text;		/* the input, behind v */
+	size_t						count;
+	struct toml_outline_section	v[];
+};
+
+static bool
+same_span(const char* a, size_t a_off, size_t a_len, const char* b,
+											size_t b_off, size_t b_len)
+{
+	return a_len == b_len && memcmp(a + a_off, b + b_off, a_len) == 0;
+}
+
+static bool
+same_headers(struct toml_outline* a, struct toml_outline* b)
+{
+	size_t i;
+
+	if (!a || a->count != b->count)
+		return false;
+
+	for (i = 1; i < a->count; i++) {
+		if (!same_span(a->text, a->v[i].header, a->v[i].header_len,
+						b->text, b->v[i].header, b->v[i].header_len))
+			return false;
+	}
+
+	return true;
+}
+
+/* Only the bodies that changed, into the tables they were parsed into before */
+static int
+reparse_bodies(struct toml_document* doc, struct toml_outline* old,
+		struct toml_outline* outline, struct toml_span* spans, char* end)
+{
+	struct toml_span	body;
+	size_t				i;
+
+	for (i = 0; i < outline->count; i++) {
+		outline->v[i].table = old->v[i].table;
+		if (same_span(old->text, old->v[i].body, old->v[i].body_len,
+				outline->text, outline->v[i].body, outline->v[i].body_len))
+			continue;
+
+		toml_outline_body(spans, outline->count, i, end, &body);
+		toml_table_clear(doc, outline->v[i].table, true);
+		if (toml_parse_table(doc, outline->v[i].table, &body, doc->flags))
+			return 1;
+	}
+
+	return 0;
+}
+
+static int
+reparse_all(struct toml_document* doc, struct toml_outline* outline,
+										struct toml_span* spans, char* end)
+{
+	struct toml_sections	log = { 0 };
+	struct toml_span		all = { spans[0].start, end - spans[0].start, 1 };
+	size_t					i;
+	int						ret;
+
+	toml_table_clear(doc, &doc->root, false);
+	doc->lazy_failed = false;
+
+	ret = toml_parse_spans(&doc->root, &all, 1, doc->flags, &log);
+	if (!ret && log.count != outline->count - 1) {
+		fprintf(stderr, "table headers out of step\n");
+		ret = 1;
+	}
+
+	outline->v[0].table = &doc->root;
+	for (i = 0; !ret && i < log.count; i++)
+		outline->v[i + 1].table = log.v[i].table;
+
+	free(log.v);
+
+	return ret;
+}
+
+int
+toml_reparse(struct toml_node* toml_root, char* buf, int buflen)
+{
+	struct toml_document*	doc;
+	struct toml_outline*	outline = NULL;
+	struct toml_span*		spans;
+	struct toml_span		body;
+	struct toml_lazy*		lazy;
+	size_t					count, i;
+	bool					whole = false;
+	int						ret = 1;
+
+	assert(toml_root->type == TOML_ROOT);
+	doc = toml_document(toml_root);
+
+	/* the document is parsed as it was first, but never lazily again */
+	doc->flags &= ~TOML_PARSE_LAZY;
+	doc->limit = NULL;
+
+	/* what is still to be read lies in the old input, a bad body in it too */
+	for (lazy = doc->lazy; lazy; lazy = lazy->next) {
+		if (lazy->table && toml_lazy_load(lazy->table))
+			whole = true;
+	}
+	toml_lazy_free(doc);
+
+	if ((doc->flags & TOML_PARSE_BORROW) && toml_borrow(doc, buf, buflen)) {
+		fprintf(stderr, "malloc failed\n");
+		return 1;
+	}
+
+	spans = toml_outline(buf, buflen, &count);
+	if (spans)
+		outline = malloc(sizeof(*outline) + count * sizeof(outline->v[0]) + buflen);
+	if (!outline) {
+		fprintf(stderr, "malloc failed\n");
+		goto out;
+	}
+
+	outline->text = (char*)&outline->v[count];
+	memcpy(outline->text, buf, buflen);
+	outline->count = count;
+	for (i = 0; i < count; i++) {
+		toml_outline_body(spans, count, i, buf + buflen, &body);
+		outline->v[i].header = spans[i].start - buf;
+		outline->v[i].header_len = i ? spans[i].len : 0;
+		outline->v[i].body = body.start - buf;
+		outline->v[i].body_len = body.len;
+	}
+
+	if (!whole && same_headers(doc->outline, outline))
+		ret = reparse_bodies(doc, doc->outline, outline, spans, buf + buflen);
+	else
+		ret = reparse_all(doc, outline, spans, buf + buflen);
+
+out:
+	/* after a failure the next toml_reparse() starts from scratch */
+	free(doc->outline);
+	doc->outline = ret ? NULL : outline;
+	if (ret)
+		free(outline);
+	free(spans);
+
+	return ret;
+}
@@ -0,0 +1,232 @@
+#include "toml_private.h"
+
+#include <string.h>
+
+/*
+ * The bodies of strings are skipped over many bytes at a time, stopping only
+ * at the bytes that can end a clean span: the closing quote and, in basic
+ * strings, a backslash.  Newlines passed over are counted.  Which version is
+ * used is decided once, by what the CPU we are running on supports.
+ */
+
+typedef const char* (*scan_fn)(const char*, const char*, char, char, int*);
+
+static const char*
+scan_scalar(const char* p, const char* pe, char a, char b, int* lines)
+{
+	for (; p < pe; p++) {
+		if (*p == a || *p == b)
+			break;
+		if (*p == '\n')
+			(*lines)++;
+	}
+
+	return p;
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+
+__attribute__((target("sse2")))
+static const char*
+scan_sse2(const char* p, const char* pe, char a, char b, int* lines)
+{
+	const __m128i	va = _mm_set1_epi8(a);
+	const __m128i	vb = _mm_set1_epi8(b);
+	const __m128i	vn = _mm_set1_epi8('\n');
+	__m128i			v;
+	unsigned int	stop, nl;
+
+	for (; pe - p >= 16; p += 16) {
+		v = _mm_loadu_si128((const __m128i*)p);
+		stop = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, va),
+												_mm_cmpeq_epi8(v, vb)));
+		nl = _mm_movemask_epi8(_mm_cmpeq_epi8(v, vn));
+
+		if (stop) {
+			stop = __builtin_ctz(stop);
+			*lines += __builtin_popcount(nl & ((1u << stop) - 1));
+			return p + stop;
+		}
+
+		*lines += __builtin_popcount(nl);
+	}
+
+	return scan_scalar(p, pe, a, b, lines);
+}
+
+__attribute__((target("avx2")))
+static const char*
+scan_avx2(const char* p, const char* pe, char a, char b, int* lines)
+{
+	const __m256i	va = _mm256_set1_epi8(a);
+	const __m256i	vb = _mm256_set1_epi8(b);
+	const __m256i	vn = _mm256_set1_epi8('\n');
+	__m256i			v;
+	unsigned int	stop, nl;
+
+	for (; pe - p >= 32; p += 32) {
+		v = _mm256_loadu_si256((const __m256i*)p);
+		stop = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, va),
+													_mm256_cmpeq_epi8(v, vb)));
+		nl = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, vn));
+
+		if (stop) {
+			stop = __builtin_ctz(stop);
+			*lines += __builtin_popcount(nl & ((1u << stop) - 1));
+			return p + stop;
+		}
+
+		*lines += __builtin_popcount(nl);
+	}
+
+	return scan_sse2(p, pe, a, b, lines);
+}
+
+static scan_fn scan = scan_scalar;
+
+__attribute__((constructor))
+static void
+scan_select(void)
+{
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx2"))
+		scan = scan_avx2;
+	else if (__builtin_cpu_supports("sse2"))
+		scan = scan_sse2;
+}
+#else
+static const scan_fn scan = scan_scalar;
+#endif
+
+/*
+ * The first byte from p on that is a or b, or pe if there is none.  A string
+ * with only the one terminator passes it as both.
+ */
+const char*
+toml_scan_string(const char* p, const char* pe, char a, char b, int* lines)
+{
+	return scan(p, pe, a, b, lines);
+}
+
+/* The byte after the string starting at p, counting the lines it spans */
+static char*
+skip_string(char* p, char* end, int* line)
+{
+	char	quote = *p;
+	bool	multi = end - p >= 3 && p[1] == quote && p[2] == quote;
+
+	for (p += multi ? 3 : 1; p < end; p++) {
+		/* most of a long string is jumped over, newlines and all */
+		if (multi) {
+			p = (char*)toml_scan_string(p, end, quote,
+										quote == '"' ? '\\' : quote, line);
+			if (p == end)
+				break;
+		}
+
+		if (*p == '\\' && quote == '"') {
+			if (++p < end && *p == '\n')
+				(*line)++;
+			continue;
+		}
+
+		if (*p == '\n') {
+			/* unterminated, which is for the parser to complain about */
+			if (!multi)
+				return p;
+			(*line)++;
+		}
+
+		if (*p == quote) {
+			if (!multi)
+				return p + 1;
+			if (end - p >= 3 && p[1] == quote && p[2] == quote)
+				return p + 3;
+		}
+	}
+
+	return end;
+}
+
+/*
+ * Hand fn each table header in buf, with the end of its line and its line
+ * number, until it returns false.  Headers are only looked for at the start
+ * of a line outside of strings and of arrays or inline tables.
+ */
+void
+toml_scan_headers(char* buf, size_t len, toml_header_fn fn, void* ctx)
+{
+	char*	p = buf;
+	char*	end = buf + len;
+	char*	header;
+	int		depth = 0, line = 1, header_line;
+	bool	line_start = true;
+
+	while (p < end) {
+		switch (*p) {
+		case '\n':
+			line++;
+			line_start = true;
+			p++;
+			continue;
+
+		case ' ':
+		case '\t':
+		case '\r':
+			p++;
+			continue;
+
+		case '#':
+			p = memchr(p, '\n', end - p);
+			if (!p)
+				p = end;
+			continue;
+
+		case '"':
+		case '\'':
+			p = skip_string(p, end, &line);
+			break;
+
+		case '[':
+			if (!line_start || depth) {
+				depth++;
+				p++;
+				break;
+			}
+
+			/* nothing else on the line of a header can open a value */
+			header = p;
+			header_line = line;
+			while (p < end && *p != '\n') {
+				if (*p == '"' || *p == '\'')
+					p = skip_string(p, end, &line);
+				else
+					p++;
+			}
+
+			if (!fn(ctx, header, p, header_line))
+				return;
+			break;
+
+		case '{':
+			depth++;
+			p++;
+			break;
+
+		case ']':
+		case '}':
+			if (depth)
+				depth--;
+			p++;
+			break;
+
+		default:
+			p++;
+			break;
+		}
+
+		line_start = false;
+	}
+}
@@ -0,0 +1,537 @@
+#include "toml.h"
+#include "toml_private.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * A snapshot is a parsed document written out flat: a header, the nodes as
+ * fixed size records in document order with each container followed by its
+ * subtree, then the names and strings and the hash indexes of big tables.
+ * Records refer to everything by offsets from themselves, so an image works
+ * wherever it is mapped and opening one is just mapping the file.
+ *
+ * toml_flatten() makes the same image in memory.  Walking it streams through
+ * the records, and any subtree can be stepped over in one go.
+ */
+
+#define FLAT_MAGIC		"TOMLSNAP"
+#define FLAT_VERSION	1
+
+#define INDEX_THRESHOLD	8
+
+/* In the header's flags */
+#define FLAT_ALLOCATED	(1 << 0)	/* by toml_flatten(), not mapped */
+
+/* The hash index of a table, slots follow */
+struct flat_index {
+	uint32_t	mask;
+	uint32_t	unused;
+};
+
+struct flat_slot {
+	uint32_t	hash;
+	uint32_t	node;		/* records on from the table, 0 if free */
+};
+
+struct flat_builder {
+	struct toml_flat_node*	nodes;
+	size_t					count;
+	size_t					size;
+	struct toml_writer		strings;
+	struct toml_writer		indexes;
+	int						error;
+};
+
+static bool
+flat_is_container(const struct toml_flat_node* flat)
+{
+	switch (flat->type & ~TOML_FLAT) {
+	case TOML_ROOT:
+	case TOML_TABLE:
+	case TOML_INLINE_TABLE:
+	case TOML_LIST:
+	case TOML_TABLE_ARRAY:
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+static bool
+flat_is_table(const struct toml_flat_node* flat)
+{
+	switch (flat->type & ~TOML_FLAT) {
+	case TOML_ROOT:
+	case TOML_TABLE:
+	case TOML_INLINE_TABLE:
+		return true;
+
+	default:
+		return false;
+	}
+}
+
+/* Offsets are kept one up while building, so that 0 can mean none */
+static int64_t
+flat_string(struct flat_builder* b, const char* s, size_t len)
+{
+	int64_t at = b->strings.len + 1;
+
+	toml_write(&b->strings, s, len);
+	toml_write(&b->strings, "", 1);
+
+	return at;
+}
+
+static struct toml_flat_node*
+flat_new(struct flat_builder* b)
+{
+	struct toml_flat_node*	nodes;
+	size_t					size = b->size ? b->size * 2 : 256;
+
+	if (b->count == b->size) {
+		nodes = realloc(b->nodes, size * sizeof(*nodes));
+		if (!nodes) {
+			b->error = ENOMEM;
+			return NULL;
+		}
+		b->nodes = nodes;
+		b->size = size;
+	}
+
+	memset(&b->nodes[b->count], 0, sizeof(b->nodes[0]));
+
+	return &b->nodes[b->count++];
+}
+
+static void
+flat_index(struct flat_builder* b, size_t table)
+{
+	struct toml_flat_node*	t = &b->nodes[table];
+	struct toml_flat_node*	child;
+	struct flat_index		index = { 0 };
+	struct flat_slot*		slots;
+	uint32_t				size = 16, i, hash;
+
+	while (t->value.container.count * 4 > size * 3)
+		size *= 2;
+
+	slots = calloc(size, sizeof(*slots));
+	if (!slots) {
+		b->error = ENOMEM;
+		return;
+	}
+
+	for (child = t + 1; child < t + t->value.container.end;
+				child += flat_is_container(child) ? child->value.container.end : 1) {
+		if (!child->name)
+			continue;
+
+		hash = toml_hash(b->strings.buf + child->name - 1, child->name_len);
+		for (i = hash & (size - 1); slots[i].node; i = (i + 1) & (size - 1))
+			;
+		slots[i].hash = hash;
+		slots[i].node = child - t;
+	}
+
+	index.mask = size - 1;
+	t->value.container.index = b->indexes.len + 1;
+	toml_write(&b->indexes, (char*)&index, sizeof(index));
+	toml_write(&b->indexes, (char*)slots, size * sizeof(*slots));
+	free(slots);
+}
+
+static void
+flat_add(struct flat_builder* b, struct toml_node* node)
+{
+	struct toml_flat_node*	flat = flat_new(b);
+	struct toml_node*		child;
+	size_t					at = b->count - 1;
+	uint32_t				count = 0;
+
+	if (!flat)
+		return;
+
+	flat->type = node->type | TOML_FLAT;
+	if (node->name) {
+		flat->name = flat_string(b, node->name, node->name_len);
+		flat->name_len = node->name_len;
+	}
+
+	switch (node->type) {
+	case TOML_INT:
+	case TOML_BOOLEAN:
+		flat->value.integer = node->value.integer;
+		break;
+
+	case TOML_FLOAT:
+		flat->value.floating.value = node->value.floating.value;
+		flat->value.floating.precision = node->value.floating.precision;
+		break;
+
+	case TOML_STRING:
+		flat->value.string.offset = flat_string(b, node->value.string,
+													node->value.string_len);
+		flat->value.string.len = node->value.string_len;
+		break;
+
+	case TOML_DATE:
+		flat->value.date.epoch = node->value.rfc3339_time.epoch;
+		flat->value.date.sec_frac = node->value.rfc3339_time.sec_frac;
+		flat->value.date.offset = node->value.rfc3339_time.offset;
+		flat->value.date.sec_frac_digits = node->value.rfc3339_time.sec_frac_digits;
+		flat->value.date.flags =
+			(node->value.rfc3339_time.offset_sign_negative ? TOML_FLAT_DATE_NEGATIVE : 0) |
+			(node->value.rfc3339_time.offset_is_zulu ? TOML_FLAT_DATE_ZULU : 0);
+		break;
+
+	default:
+		for (child = toml_first_child(node); child && !b->error;
+										child = toml_next_child(node, child)) {
+			flat_add(b, child);
+			count++;
+		}
+
+		/* b->nodes may have moved */
+		flat = &b->nodes[at];
+		flat->value.container.count = count;
+		flat->value.container.end = b->count - at;
+		if (flat_is_table(flat) && count >= INDEX_THRESHOLD && !b->error)
+			flat_index(b, at);
+		break;
+	}
+}
+
+/*
+ * The image of the document under root, in one block of malloc'd memory.
+ * Returns NULL and sets errno if it cannot be made.
+ */
+static struct toml_flat_header*
+flat_build(struct toml_node* root)
+{
+	struct flat_builder			b = { 0 };
+	struct toml_flat_header*	header = NULL;
+	struct toml_flat_node*		flat;
+	size_t						nodes, strings, size, i;
+	char*						base;
+
+	toml_writer_init(&b.strings, TOML_WRITER_BUFFER, NULL, 0);
+	toml_writer_init(&b.indexes, TOML_WRITER_BUFFER, NULL, 0);
+
+	flat_add(&b, root);
+	if (!b.error)
+		b.error = b.strings.error ? b.strings.error : b.indexes.error;
+	if (b.error)
+		goto out;
+
+	nodes = sizeof(*header) + b.count * sizeof(b.nodes[0]);
+	strings = (b.strings.len + 7) & ~(size_t)7;
+	size = nodes + strings + b.indexes.len;
+
+	header = calloc(1, size);
+	if (!header) {
+		b.error = ENOMEM;
+		goto out;
+	}
+
+	base = (char*)header;
+	memcpy(header->magic, FLAT_MAGIC, sizeof(header->magic));
+	header->version = FLAT_VERSION;
+	header->node_size = sizeof(b.nodes[0]);
+	header->size = size;
+	header->flags = 0;
+	memcpy(base + sizeof(*header), b.nodes, b.count * sizeof(b.nodes[0]));
+	memcpy(base + nodes, b.strings.buf, b.strings.len);
+	memcpy(base + nodes + strings, b.indexes.buf, b.indexes.len);
+
+	/* now that it is known where everything is, make the offsets relative */
+	flat = (struct toml_flat_node*)(header + 1);
+	for (i = 0; i < b.count; i++, flat++) {
+		int64_t at = (char*)flat - base;
+
+		if (flat->name)
+			flat->name += (int64_t)nodes - 1 - at;
+
+		if ((flat->type & ~TOML_FLAT) == TOML_STRING)
+			flat->value.string.offset += (int64_t)nodes - 1 - at;
+		else if (flat_is_container(flat) && flat->value.container.index)
+			flat->value.container.index += (int64_t)(nodes + strings) - 1 - at;
+	}
+
+out:
+	free(b.nodes);
+	free(b.strings.buf);
+	free(b.indexes.buf);
+	errno = b.error;
+
+	return b.error ? NULL : header;
+}
+
+/* Write all of buf, whatever it takes */
+static int
+write_full(int fd, const char* buf, size_t len)
+{
+	ssize_t done;
+
+	while (len) {
+		done = write(fd, buf, len);
+		if (done < 0) {
+			if (errno == EINTR)
+				continue;
+			return errno;
+		}
+		buf += done;
+		len -= done;
+	}
+
+	return 0;
+}
+
+int
+toml_save_snapshot(struct toml_node* root, const char* path)
+{
+	struct toml_flat_header*	header;
+	char						tmp[PATH_MAX];
+	int							fd, ret;
+
+	if (toml_is_flat(root))
+		return EINVAL;
+
+	if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >= (int)sizeof(tmp))
+		return ENAMETOOLONG;
+
+	header = flat_build(root);
+	if (!header)
+		return errno;
+
+	/*
+	 * Readers may have the old file mapped, which must not change under
+	 * them, so the new one is written alongside and renamed over it.
+	 */
+	fd = mkstemp(tmp);
+	if (fd < 0) {
+		ret = errno;
+		goto out;
+	}
+
+	ret = write_full(fd, (char*)header, header->size);
+	if (!ret && fchmod(fd, 0644))
+		ret = errno;
+	if (close(fd) && !ret)
+		ret = errno;
+	if (!ret && rename(tmp, path))
+		ret = errno;
+	if (ret)
+		unlink(tmp);
+
+out:
+	free(header);
+	return ret;
+}
+
+int
+toml_open_snapshot(const char* path, struct toml_node** root)
+{
+	struct toml_flat_header*	header;
+	struct stat					st;
+	int							fd, ret = 0;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return errno;
+
+	if (fstat(fd, &st)) {
+		ret = errno;
+		goto out;
+	}
+
+	if ((size_t)st.st_size < sizeof(*header) + sizeof(struct toml_flat_node)) {
+		ret = EINVAL;
+		goto out;
+	}
+
+	header = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (header == MAP_FAILED) {
+		ret = errno;
+		goto out;
+	}
+
+	/* a different version, or written on a machine of another sort */
+	if (memcmp(header->magic, FLAT_MAGIC, sizeof(header->magic)) ||
+			header->version != FLAT_VERSION ||
+			header->node_size != sizeof(struct toml_flat_node) ||
+			header->size != (uint64_t)st.st_size) {
+		munmap(header, st.st_size);
+		ret = EINVAL;
+		goto out;
+	}
+
+	*root = (struct toml_node*)(header + 1);
+
+out:
+	close(fd);
+	return ret;
+}
+
+int
+toml_flatten(struct toml_node* root, struct toml_node** flat)
+{
+	struct toml_flat_header* header;
+
+	if (toml_is_flat(root))
+		return EINVAL;
+
+	header = flat_build(root);
+	if (!header)
+		return errno;
+
+	header->flags |= FLAT_ALLOCATED;
+	*flat = (struct toml_node*)(header + 1);
+
+	return 0;
+}
+
+/* Release a flat document, as toml_free() */
+void
+toml_flat_free(struct toml_node* root)
+{
+	struct toml_flat_header* header = (struct toml_flat_header*)root - 1;
+
+	if (header->flags & FLAT_ALLOCATED)
+		free(header);
+	else
+		munmap(header, header->size);
+}
+
+/* As toml_walk(), which in a flat document is just reading it in order */
+void
+toml_flat_walk(struct toml_node* root, toml_node_walker fn, void* ctx)
+{
+	struct toml_flat_node*	flat = (struct toml_flat_node*)root;
+	struct toml_flat_node*	end;
+
+	end = flat + (flat_is_container(flat) ? flat->value.container.end : 1);
+	for (; flat < end; flat++)
+		fn((struct toml_node*)flat, ctx);
+}
+
+/* The node as a struct toml_node of its own, with no children */
+struct toml_node*
+toml_flat_view(struct toml_node* node, struct toml_node* view)
+{
+	const struct toml_flat_node*	flat = (struct toml_flat_node*)node;
+	const char*						base = (const char*)flat;
+
+	memset(view, 0, sizeof(*view));
+	view->type = flat->type & ~TOML_FLAT;
+	view->name = flat->name ? (char*)base + flat->name : NULL;
+	view->name_len = flat->name_len;
+
+	switch (view->type) {
+	case TOML_INT:
+	case TOML_BOOLEAN:
+		view->value.integer = flat->value.integer;
+		break;
+
+	case TOML_FLOAT:
+		view->value.floating.value = flat->value.floating.value;
+		view->value.floating.precision = flat->value.floating.precision;
+		break;
+
+	case TOML_STRING:
+		view->value.string = (char*)base + flat->value.string.offset;
+		view->value.string_len = flat->value.string.len;
+		break;
+
+	case TOML_DATE:
+		view->value.rfc3339_time.epoch = flat->value.date.epoch;
+		view->value.rfc3339_time.sec_frac = flat->value.date.sec_frac;
+		view->value.rfc3339_time.offset = flat->value.date.offset;
+		view->value.rfc3339_time.sec_frac_digits = flat->value.date.sec_frac_digits;
+		view->value.rfc3339_time.offset_sign_negative =
+						!!(flat->value.date.flags & TOML_FLAT_DATE_NEGATIVE);
+		view->value.rfc3339_time.offset_is_zulu =
+						!!(flat->value.date.flags & TOML_FLAT_DATE_ZULU);
+		break;
+
+	default:
+		list_head_init(&view->value.map);
+		break;
+	}
+
+	return view;
+}
+
+struct toml_node*
+toml_flat_first(struct toml_node* node)
+{
+	struct toml_flat_node* flat = (struct toml_flat_node*)node;
+
+	if (!flat_is_container(flat) || !flat->value.container.count)
+		return NULL;
+
+	return (struct toml_node*)(flat + 1);
+}
+
+struct toml_node*
+toml_flat_next(struct toml_node* parent, struct toml_node* child)
+{
+	struct toml_flat_node*	p = (struct toml_flat_node*)parent;
+	struct toml_flat_node*	c = (struct toml_flat_node*)child;
+
+	c += flat_is_container(c) ? c->value.container.end : 1;
+
+	return c < p + p->value.container.end ? (struct toml_node*)c : NULL;
+}
+
+static bool
+flat_name_matches(const struct toml_flat_node* flat, const char* name,
+																size_t len)
+{
+	return flat->name && flat->name_len == len &&
+						memcmp((const char*)flat + flat->name, name, len) == 0;
+}
+
+struct toml_node*
+toml_flat_lookup(struct toml_node* table, const char* name, size_t len,
+																uint32_t hash)
+{
+	struct toml_flat_node*		t = (struct toml_flat_node*)table;
+	const struct flat_index*	index;
+	const struct flat_slot*		slots;
+	struct toml_node*			child;
+	uint32_t					i;
+
+	if (!flat_is_table(t))
+		return NULL;
+
+	if (t->value.container.index) {
+		index = (const struct flat_index*)((char*)t + t->value.container.index);
+		slots = (const struct flat_slot*)(index + 1);
+
+		for (i = hash & index->mask; slots[i].node; i = (i + 1) & index->mask) {
+			if (slots[i].hash == hash &&
+							flat_name_matches(t + slots[i].node, name, len))
+				return (struct toml_node*)(t + slots[i].node);
+		}
+
+		return NULL;
+	}
+
+	for (child = toml_flat_first(table); child;
+									child = toml_flat_next(table, child)) {
+		if (flat_name_matches((struct toml_flat_node*)child, name, len))
+			return child;
+	}
+
+	return NULL;
+}
@@ -0,0 +1,250 @@
+#include "toml_private.h"
+
+#include <stdint.h>
+
+/*
+ * Input is checked to be UTF-8 before the parser sees it.  The vector versions
+ * look every byte up by its own high nibble and the nibbles of the byte before
+ * it (Keiser and Lemire, "Validating UTF-8 In Less Than One Instruction Per
+ * Byte"), which leaves set bits wherever the pair cannot occur.  Only where
+ * they find something wrong, and for the last few bytes, does the scalar
+ * version take over, to say exactly where.
+ */
+
+typedef const char* (*check_fn)(const char*, const char*, bool*);
+
+static const char*
+check_scalar(const char* start, const char* pe, bool* partial)
+{
+	const uint8_t*	p = (const uint8_t*)start;
+	const uint8_t*	end = (const uint8_t*)pe;
+	uint8_t			lo, hi;
+	int				n, i;
+
+	while (p < end) {
+		if (*p < 0x80) {
+			p++;
+			continue;
+		}
+
+		lo = 0x80;
+		hi = 0xbf;
+		if (*p >= 0xc2 && *p <= 0xdf) {
+			n = 1;
+		} else if (*p >= 0xe0 && *p <= 0xef) {
+			n = 2;
+			if (*p == 0xe0)
+				lo = 0xa0;			/* overlong */
+			else if (*p == 0xed)
+				hi = 0x9f;			/* surrogate */
+		} else if (*p >= 0xf0 && *p <= 0xf4) {
+			n = 3;
+			if (*p == 0xf0)
+				lo = 0x90;			/* overlong */
+			else if (*p == 0xf4)
+				hi = 0x8f;			/* past U+10FFFF */
+		} else {
+			break;
+		}
+
+		for (i = 1; i <= n; i++) {
+			if (p + i == end) {
+				*partial = true;
+				return (const char*)p;
+			}
+			if (p[i] < lo || p[i] > hi)
+				return (const char*)p;
+			lo = 0x80;
+			hi = 0xbf;
+		}
+
+		p += n + 1;
+	}
+
+	return (const char*)p;
+}
+
+/*
+ * Back from p, which the vector code got to, to the start of the character
+ * it may be in the middle of.
+ */
+static const char*
+char_start(const char* start, const char* p)
+{
+	int	i;
+
+	for (i = 1; i <= 3 && p - i >= start; i++) {
+		if (((uint8_t)p[-i] & 0xc0) != 0x80)
+			return (uint8_t)p[-i] >= 0xc0 ? p - i : p;
+	}
+
+	return p;
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+
+/* What each half of a pair of bytes may be wrong about */
+#define TOO_SHORT		(1 << 0)	/* lead not followed by continuation */
+#define TOO_LONG		(1 << 1)	/* continuation after ASCII */
+#define OVERLONG_3		(1 << 2)
+#define TOO_LARGE		(1 << 3)
+#define SURROGATE		(1 << 4)
+#define OVERLONG_2		(1 << 5)
+#define TOO_LARGE_1000	(1 << 6)
+#define OVERLONG_4		(1 << 6)
+#define TWO_CONTS		(1 << 7)	/* unless a third or fourth byte */
+#define CARRY			(TOO_SHORT | TOO_LONG | TWO_CONTS)
+
+#define BYTE_1_HIGH																\
+	TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,										\
+	TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,										\
+	TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,									\
+	TOO_SHORT | OVERLONG_2,														\
+	TOO_SHORT,																	\
+	TOO_SHORT | OVERLONG_3 | SURROGATE,											\
+	TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4
+
+#define BYTE_1_LOW																\
+	CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,								\
+	CARRY | OVERLONG_2,															\
+	CARRY,																		\
+	CARRY,																		\
+	CARRY | TOO_LARGE,															\
+	CARRY | TOO_LARGE | TOO_LARGE_1000,											\
+	CARRY | TOO_LARGE | TOO_LARGE_1000,											\
+	CARRY | TOO_LARGE | TOO_LARGE_1000,											\
+	CARRY | TOO_LARGE | TOO_LARGE_1000,											\
+	CARRY | TOO_LARGE | TOO_LARGE_1000,											\
+	CARRY | TOO_LARGE | TOO_LARGE_1000,											\
+	CARRY | TOO_LARGE | TOO_LARGE_1000,											\
+	CARRY | TOO_LARGE | TOO_LARGE_1000,											\
+	CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,								\
+	CARRY | TOO_LARGE | TOO_LARGE_1000,											\
+	CARRY | TOO_LARGE | TOO_LARGE_1000
+
+#define BYTE_2_HIGH																\
+	TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,									\
+	TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,									\
+	TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,	\
+	TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,					\
+	TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,					\
+	TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,					\
+	TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT
+
+__attribute__((target("ssse3")))
+static const char*
+check_ssse3(const char* start, const char* pe, bool* partial)
+{
+	const __m128i	byte_1_high = _mm_setr_epi8(BYTE_1_HIGH);
+	const __m128i	byte_1_low = _mm_setr_epi8(BYTE_1_LOW);
+	const __m128i	byte_2_high = _mm_setr_epi8(BYTE_2_HIGH);
+	const __m128i	nibble = _mm_set1_epi8(0x0f);
+	/* the last bytes of a block that leave a character open */
+	const __m128i	open = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1,
+							-1, -1, -1, -1, -1, 0xef - 256, 0xdf - 256, 0xbf - 256);
+	const char*		p = start;
+	__m128i			v, prev = _mm_setzero_si128(), prev1, error;
+	__m128i			incomplete = _mm_setzero_si128();
+
+	for (; pe - p >= 16; p += 16) {
+		v = _mm_loadu_si128((const __m128i*)p);
+
+		if (!_mm_movemask_epi8(v)) {
+			error = incomplete;
+		} else {
+			prev1 = _mm_alignr_epi8(v, prev, 15);
+			error = _mm_and_si128(_mm_and_si128(
+				_mm_shuffle_epi8(byte_1_high, _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble)),
+				_mm_shuffle_epi8(byte_1_low, _mm_and_si128(prev1, nibble))),
+				_mm_shuffle_epi8(byte_2_high, _mm_and_si128(_mm_srli_epi16(v, 4), nibble)));
+			/* third and fourth bytes are the only continuations allowed after one */
+			error = _mm_xor_si128(error, _mm_and_si128(_mm_or_si128(
+				_mm_subs_epu8(_mm_alignr_epi8(v, prev, 14), _mm_set1_epi8(0xe0 - 0x80)),
+				_mm_subs_epu8(_mm_alignr_epi8(v, prev, 13), _mm_set1_epi8(0xf0 - 0x80))),
+				_mm_set1_epi8(0x80 - 256)));
+		}
+
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(error, _mm_setzero_si128())) != 0xffff)
+			break;
+
+		incomplete = _mm_subs_epu8(v, open);
+		prev = v;
+	}
+
+	return check_scalar(char_start(start, p), pe, partial);
+}
+
+__attribute__((target("avx2")))
+static const char*
+check_avx2(const char* start, const char* pe, bool* partial)
+{
+	const __m256i	byte_1_high = _mm256_setr_epi8(BYTE_1_HIGH, BYTE_1_HIGH);
+	const __m256i	byte_1_low = _mm256_setr_epi8(BYTE_1_LOW, BYTE_1_LOW);
+	const __m256i	byte_2_high = _mm256_setr_epi8(BYTE_2_HIGH, BYTE_2_HIGH);
+	const __m256i	nibble = _mm256_set1_epi8(0x0f);
+	const __m256i	open = _mm256_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1,
+							-1, -1, -1, -1, -1, -1, -1, -1,
+							-1, -1, -1, -1, -1, -1, -1, -1,
+							-1, -1, -1, -1, -1, 0xef - 256, 0xdf - 256, 0xbf - 256);
+	const char*		p = start;
+	__m256i			v, prev = _mm256_setzero_si256(), shifted, prev1, error;
+	__m256i			incomplete = _mm256_setzero_si256();
+
+	for (; pe - p >= 32; p += 32) {
+		v = _mm256_loadu_si256((const __m256i*)p);
+
+		if (!_mm256_movemask_epi8(v)) {
+			error = incomplete;
+		} else {
+			/* the bytes before each half of v, for the alignr's */
+			shifted = _mm256_permute2x128_si256(prev, v, 0x21);
+			prev1 = _mm256_alignr_epi8(v, shifted, 15);
+			error = _mm256_and_si256(_mm256_and_si256(
+				_mm256_shuffle_epi8(byte_1_high, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble)),
+				_mm256_shuffle_epi8(byte_1_low, _mm256_and_si256(prev1, nibble))),
+				_mm256_shuffle_epi8(byte_2_high, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble)));
+			error = _mm256_xor_si256(error, _mm256_and_si256(_mm256_or_si256(
+				_mm256_subs_epu8(_mm256_alignr_epi8(v, shifted, 14), _mm256_set1_epi8(0xe0 - 0x80)),
+				_mm256_subs_epu8(_mm256_alignr_epi8(v, shifted, 13), _mm256_set1_epi8(0xf0 - 0x80))),
+				_mm256_set1_epi8(0x80 - 256)));
+		}
+
+		if (!_mm256_testz_si256(error, error))
+			break;
+
+		incomplete = _mm256_subs_epu8(v, open);
+		prev = v;
+	}
+
+	return check_scalar(char_start(start, p), pe, partial);
+}
+
+static check_fn check = check_scalar;
+
+__attribute__((constructor))
+static void
+check_select(void)
+{
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx2"))
+		check = check_avx2;
+	else if (__builtin_cpu_supports("ssse3"))
+		check = check_ssse3;
+}
+#else
+static const check_fn check = check_scalar;
+#endif
+
+/*
+ * Where [p, pe) stops being UTF-8, pe if it never does.  *partial is set if
+ * what is left is the start of a character that pe cuts short.
+ */
+const char*
+toml_utf8_check(const char* p, const char* pe, bool* partial)
+{
+	*partial = false;
+
+	return check(p, pe, partial);
+}
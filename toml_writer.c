@@ -0,0 +1,357 @@
+#include "toml.h"
+#include "toml_private.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+/*
+ * Output is gathered in a buffer and handed on in big pieces.  A writer into
+ * memory grows its buffer instead, anything else empties it whenever it
+ * fills, passing on large writes straight from the caller's memory.
+ */
+
+#define WRITER_BUFFER_SIZE	(64 * 1024)
+
+void
+toml_writer_init(struct toml_writer* w, enum toml_writer_kind kind, char* buf,
+																size_t size)
+{
+	memset(w, 0, sizeof(*w));
+	w->kind = kind;
+	w->buf = buf;
+	w->size = size;
+	w->fd = -1;
+}
+
+static struct toml_writer*
+writer_new(enum toml_writer_kind kind)
+{
+	struct toml_writer* w;
+
+	w = malloc(sizeof(*w) + WRITER_BUFFER_SIZE);
+	if (!w)
+		return NULL;
+
+	toml_writer_init(w, kind, (char*)(w + 1), WRITER_BUFFER_SIZE);
+
+	return w;
+}
+
+struct toml_writer*
+toml_writer_buffer(void)
+{
+	struct toml_writer* w = malloc(sizeof(*w));
+
+	if (w)
+		toml_writer_init(w, TOML_WRITER_BUFFER, NULL, 0);
+
+	return w;
+}
+
+struct toml_writer*
+toml_writer_fd(int fd)
+{
+	struct toml_writer* w = writer_new(TOML_WRITER_FD);
+
+	if (w)
+		w->fd = fd;
+
+	return w;
+}
+
+struct toml_writer*
+toml_writer_callback(toml_write_fn fn, void* ctx)
+{
+	struct toml_writer* w = writer_new(TOML_WRITER_CALLBACK);
+
+	if (w) {
+		w->fn = fn;
+		w->ctx = ctx;
+	}
+
+	return w;
+}
+
+/* Write out iov in full, however many goes it takes */
+static int
+write_all(int fd, struct iovec* iov, int count)
+{
+	ssize_t	done;
+
+	while (count) {
+		done = writev(fd, iov, count);
+		if (done < 0) {
+			if (errno == EINTR)
+				continue;
+			return errno;
+		}
+
+		for (; count && (size_t)done >= iov->iov_len; iov++, count--)
+			done -= iov->iov_len;
+
+		if (count) {
+			iov->iov_base = (char*)iov->iov_base + done;
+			iov->iov_len -= done;
+		}
+	}
+
+	return 0;
+}
+
+/* Pass on what is buffered followed by len bytes of data */
+static void
+writer_drain(struct toml_writer* w, const char* data, size_t len)
+{
+	struct iovec	iov[2];
+	int				count = 0;
+
+	if (!w->error && w->kind == TOML_WRITER_FD) {
+		if (w->len) {
+			iov[count].iov_base = w->buf;
+			iov[count++].iov_len = w->len;
+		}
+		if (len) {
+			iov[count].iov_base = (char*)data;
+			iov[count++].iov_len = len;
+		}
+		w->error = write_all(w->fd, iov, count);
+	} else if (!w->error && w->kind == TOML_WRITER_CALLBACK) {
+		if (w->len)
+			w->error = w->fn(w->ctx, w->buf, w->len);
+		if (!w->error && len)
+			w->error = w->fn(w->ctx, data, len);
+	}
+
+	w->len = 0;
+}
+
+/* Make room for at least len more bytes in a writer into memory */
+static bool
+writer_grow(struct toml_writer* w, size_t len)
+{
+	size_t	size = w->size ? w->size : 256;
+	char*	buf;
+
+	if (w->error)
+		return false;
+
+	while (size - w->len < len)
+		size *= 2;
+
+	buf = realloc(w->buf, size);
+	if (!buf) {
+		w->error = ENOMEM;
+		return false;
+	}
+
+	w->buf = buf;
+	w->size = size;
+
+	return true;
+}
+
+void
+toml_write(struct toml_writer* w, const char* data, size_t len)
+{
+	if (!len)
+		return;
+
+	if (len > w->size - w->len) {
+		if (w->kind == TOML_WRITER_BUFFER) {
+			if (!writer_grow(w, len))
+				return;
+		} else if (len >= w->size / 2) {
+			writer_drain(w, data, len);
+			return;
+		} else {
+			writer_drain(w, NULL, 0);
+		}
+	}
+
+	memcpy(w->buf + w->len, data, len);
+	w->len += len;
+}
+
+/* Formatted straight into the buffer when it has the room */
+void
+toml_writef(struct toml_writer* w, const char* fmt, ...)
+{
+	va_list	ap;
+	char*	big;
+	int		len;
+
+	if (!w->buf && !writer_grow(w, 32))
+		return;
+
+	va_start(ap, fmt);
+	len = vsnprintf(w->buf + w->len, w->size - w->len, fmt, ap);
+	va_end(ap);
+
+	if (len < 0 || (size_t)len < w->size - w->len) {
+		if (len > 0)
+			w->len += len;
+		return;
+	}
+
+	if (w->kind == TOML_WRITER_BUFFER) {
+		if (!writer_grow(w, len + 1))
+			return;
+	} else if ((size_t)len < w->size) {
+		writer_drain(w, NULL, 0);
+	} else {
+		/* more than the whole buffer, which only a huge float can be */
+		big = malloc(len + 1);
+		if (!big) {
+			w->error = ENOMEM;
+			return;
+		}
+
+		va_start(ap, fmt);
+		vsnprintf(big, len + 1, fmt, ap);
+		va_end(ap);
+
+		toml_write(w, big, len);
+		free(big);
+		return;
+	}
+
+	va_start(ap, fmt);
+	w->len += vsnprintf(w->buf + w->len, w->size - w->len, fmt, ap);
+	va_end(ap);
+}
+
+/* Copy clean runs as they are, only stopping for what needs escaping */
+void
+toml_write_escaped(struct toml_writer* w, const char* s, size_t len)
+{
+	const char*	end = s + len;
+	const char*	clean = s;
+	char		escape[2] = { '\\' };
+
+	for (; s < end; s++) {
+		switch (*s) {
+		case '"':
+		case '\\':
+		case '/':
+			escape[1] = *s;
+			break;
+		case '\b':
+			escape[1] = 'b';
+			break;
+		case '\f':
+			escape[1] = 'f';
+			break;
+		case '\n':
+			escape[1] = 'n';
+			break;
+		case '\r':
+			escape[1] = 'r';
+			break;
+		case '\t':
+			escape[1] = 't';
+			break;
+		default:
+			continue;
+		}
+
+		toml_write(w, clean, s - clean);
+		toml_write(w, escape, 2);
+		clean = s + 1;
+	}
+
+	toml_write(w, clean, end - clean);
+}
+
+static void
+write_int(struct toml_writer* w, int64_t value)
+{
+	char		digits[24];
+	char*		p = digits + sizeof(digits);
+	uint64_t	u = value < 0 ? -(uint64_t)value : (uint64_t)value;
+
+	do {
+		*--p = '0' + u % 10;
+		u /= 10;
+	} while (u);
+
+	if (value < 0)
+		*--p = '-';
+
+	toml_write(w, p, digits + sizeof(digits) - p);
+}
+
+/* The value of a scalar node, with strings escaped but not quoted */
+void
+toml_write_value(struct toml_writer* w, struct toml_node* node)
+{
+	switch (node->type) {
+	case TOML_INT:
+		write_int(w, node->value.integer);
+		break;
+
+	case TOML_FLOAT:
+		toml_writef(w, "%.*f", node->value.floating.precision,
+										node->value.floating.value);
+		break;
+
+	case TOML_STRING:
+		toml_write_escaped(w, node->value.string, node->value.string_len);
+		break;
+
+	case TOML_DATE: {
+		char	date[TOML_DATE_MAX];
+
+		toml_write(w, date, toml_format_date(node, date, sizeof(date)));
+		break;
+	}
+
+	case TOML_BOOLEAN:
+		if (node->value.integer)
+			toml_write_str(w, "true");
+		else
+			toml_write_str(w, "false");
+		break;
+
+	default:
+		break;
+	}
+}
+
+const char*
+toml_writer_data(struct toml_writer* w, size_t* len)
+{
+	if (w->kind != TOML_WRITER_BUFFER)
+		return NULL;
+
+	if (len)
+		*len = w->len;
+
+	return w->buf ? w->buf : "";
+}
+
+int
+toml_writer_flush(struct toml_writer* w)
+{
+	if (w->kind != TOML_WRITER_BUFFER)
+		writer_drain(w, NULL, 0);
+
+	return w->error;
+}
+
+int
+toml_writer_free(struct toml_writer* w)
+{
+	int ret = toml_writer_flush(w);
+
+	if (w->kind == TOML_WRITER_BUFFER)
+		free(w->buf);
+	free(w);
+
+	return ret;
+}